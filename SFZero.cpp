@@ -5,9 +5,13 @@
 #include "sfzero/SFZCommon.cpp" 
 #include "sfzero/SFZDebug.cpp" 
 #include "sfzero/SFZEG.cpp" 
+#include "sfzero/SFZInterpolation.cpp" 
+#include "sfzero/SFZMidiQueue.cpp" 
 #include "sfzero/SFZReader.cpp" 
 #include "sfzero/SFZRegion.cpp" 
+#include "sfzero/SFZRenderPool.cpp" 
 #include "sfzero/SFZSample.cpp" 
 #include "sfzero/SFZSound.cpp"
 #include "sfzero/SFZSynth.cpp"
 #include "sfzero/SFZVoice.cpp"
+#include "sfzero/SFZVoicePool.cpp"
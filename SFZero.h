@@ -17,13 +17,17 @@ END_JUCE_MODULE_DECLARATION
 #include "sfzero/SFZCommon.h"
 #include "sfzero/SFZDebug.h"
 #include "sfzero/SFZEG.h"
+#include "sfzero/SFZInterpolation.h"
+#include "sfzero/SFZMidiQueue.h"
 #include "sfzero/SFZReader.h"
 #include "sfzero/SFZRegion.h"
+#include "sfzero/SFZRenderPool.h"
 #include "sfzero/SFZSampleLoader.h"
 #include "sfzero/SFZSample.h"
 #include "sfzero/SFZSound.h"
 #include "sfzero/SFZSynth.h"
 #include "sfzero/SFZVoice.h"
+#include "sfzero/SFZVoicePool.h"
 
 
 #endif   // INCLUDED_SFZERO_H
@@ -0,0 +1,98 @@
+/*************************************************************************************
+ * Original code copyright (C) 2012 Steve Folta
+ * Converted to Juce module (C) 2016 Leo Olivers
+ * Forked from https://github.com/stevefolta/SFZero
+ * For license info please see the LICENSE file distributed with this source code
+ *************************************************************************************/
+#ifndef SFZBENCHCOMMON_H_INCLUDED
+#define SFZBENCHCOMMON_H_INCLUDED
+
+// What the benchmarks share: sounds made from generated samples, so they
+// need no files, and a timer.  Each benchmark is one file that builds the
+// whole module in, the way a host does, so it builds like the module itself,
+// against Carla's water and utils, e.g. from this directory:
+//
+//   g++ -std=c++17 -O2 -I$CARLA/source/modules -I$CARLA/source/utils
+//       -I$CARLA/source/includes VoiceScaling.cpp $WATER_LIB -lpthread
+//       -o VoiceScaling
+//
+// with $WATER_LIB the water.a that Carla's build makes.  Run them on an
+// otherwise idle machine; they print the best of several runs.
+
+#include "../SFZero.cpp"
+
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace sfzero
+{
+namespace bench
+{
+
+static const double sampleRate = 44100.0;
+
+// Loads every sample as "numFrames" frames of a quiet sine in each of
+// "numChannels" channels, whatever its name.
+class SineLoader : public SampleLoader
+{
+public:
+  SineLoader(uint64_t numFrames, unsigned int numChannels) : numFrames_(numFrames), numChannels_(numChannels) {}
+
+  bool load(const std::string & /*file*/, const std::string & /*defaultPath*/, SampleBuffer &buffer) override
+  {
+    buffer.sampleRate = sampleRate;
+    buffer.numChannels = numChannels_;
+    buffer.sampleLength = numFrames_;
+    buffer.loopStart = 0;
+    buffer.loopEnd = 0;
+    buffer.samples = std::shared_ptr<float[]>(new float[numFrames_ * numChannels_]);
+    for (uint64_t i = 0; i < numFrames_ * numChannels_; ++i)
+    {
+      buffer.samples[i] = 0.3f * static_cast<float>(std::sin(i * 0.01));
+    }
+    return true;
+  }
+
+private:
+  uint64_t numFrames_;
+  unsigned int numChannels_;
+};
+
+// A sound read from "sfz", with its samples loaded through "loader".
+inline Sound::Ptr makeSound(const std::string &sfz, SampleLoader &loader)
+{
+  Sound::Ptr sound = new Sound("bench.sfz");
+  Reader reader(sound.get());
+  reader.read(sfz.c_str(), static_cast<unsigned int>(sfz.size()));
+  Sound::LoadingIdleCallback callback = {nullptr, nullptr};
+  sound->loadSamples(loader, callback);
+  return sound;
+}
+
+// Measures both the time taken and the CPU time the process used, over all
+// its threads.  The CPU time is what counts on a busy machine, and with
+// render threads it includes whatever their waiting costs.
+class Timer
+{
+public:
+  Timer() : start_(std::chrono::steady_clock::now()), startCpu_(std::clock()) {}
+
+  double getSeconds() const
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+  }
+  double getCpuSeconds() const { return static_cast<double>(std::clock() - startCpu_) / CLOCKS_PER_SEC; }
+
+private:
+  std::chrono::steady_clock::time_point start_;
+  std::clock_t startCpu_;
+};
+
+}
+}
+
+#endif // SFZBENCHCOMMON_H_INCLUDED
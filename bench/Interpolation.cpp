@@ -0,0 +1,83 @@
+/*************************************************************************************
+ * Original code copyright (C) 2012 Steve Folta
+ * Converted to Juce module (C) 2016 Leo Olivers
+ * Forked from https://github.com/stevefolta/SFZero
+ * For license info please see the LICENSE file distributed with this source code
+ *************************************************************************************/
+
+// What each interpolation quality costs: renders the same looping voices,
+// detuned so every frame falls between samples, at each quality in turn, and
+// prints the CPU time per voice per frame and how many such voices one core
+// could keep up with in real time.  The table in SFZInterpolation.h comes
+// from this.
+//
+//   Interpolation [voices]
+
+#include "BenchCommon.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace sfzero;
+
+static const int blockSize = 256;
+static const double secondsRendered = 5.0;
+static const int numRuns = 5;
+static const int numQualities = 4;
+
+int main(int argc, char **argv)
+{
+  const char *qualityNames[numQualities] = {"linear", "hermite", "sinc8", "sinc16"};
+  int numVoices = (argc > 1) ? std::atoi(argv[1]) : 64;
+  numVoices = std::max(1, std::min(numVoices, 128));
+
+  bench::SineLoader loader(441000, 2);
+  // 13 cents sharp, so no voice lands on whole samples.
+  Sound::Ptr sound = bench::makeSound("<region> sample=sine.wav loop_mode=loop_continuous loop_start=1000 "
+                                      "loop_end=400000 pitch_keycenter=60 tune=13\n",
+                                      loader);
+  water::AudioSampleBuffer output(blockSize);
+  int numBlocks = static_cast<int>(secondsRendered * bench::sampleRate / blockSize);
+
+  // The runs of each quality are interleaved with the others', so a busy
+  // spell on the machine doesn't all land on one of them.
+  double best[numQualities] = {};
+  int numPlaying[numQualities] = {};
+  for (int run = 0; run < numRuns; ++run)
+  {
+    for (int quality = 0; quality < numQualities; ++quality)
+    {
+      Synth synth;
+      for (int i = 0; i < numVoices; ++i)
+      {
+        synth.addVoice(new Voice());
+      }
+      synth.addSound(sound.get());
+      synth.setCurrentPlaybackSampleRate(bench::sampleRate);
+      synth.setInterpolationQuality(static_cast<InterpolationQuality>(quality));
+      for (int note = 0; note < numVoices; ++note)
+      {
+        synth.noteOn(1, note, 1.0f);
+      }
+
+      bench::Timer timer;
+      for (int block = 0; block < numBlocks; ++block)
+      {
+        synth.renderNextBlock(output, nullptr, 0, 0, blockSize);
+      }
+      double seconds = timer.getCpuSeconds();
+      best[quality] = (run == 0) ? seconds : std::min(best[quality], seconds);
+      numPlaying[quality] = synth.numVoicesUsed();
+    }
+  }
+
+  std::printf("%d voices, %d-frame blocks\n", numVoices, blockSize);
+  std::printf("quality  ns/voice/frame  voices per core  x linear\n");
+  for (int quality = 0; quality < numQualities; ++quality)
+  {
+    double voiceFrames = static_cast<double>(numPlaying[quality]) * numBlocks * blockSize;
+    std::printf("%-7s  %14.2f  %15.0f  %8.2f\n", qualityNames[quality], best[quality] * 1e9 / voiceFrames,
+                voiceFrames / bench::sampleRate / best[quality], best[quality] / best[0]);
+  }
+  return 0;
+}
@@ -0,0 +1,171 @@
+/*************************************************************************************
+ * Original code copyright (C) 2012 Steve Folta
+ * Converted to Juce module (C) 2016 Leo Olivers
+ * Forked from https://github.com/stevefolta/SFZero
+ * For license info please see the LICENSE file distributed with this source code
+ *************************************************************************************/
+
+// How MIDI input from several threads holds up under contention: producer
+// threads push events as fast as they can while one consumer drains them,
+// through a MidiQueue, through a mutex-guarded vector for comparison, and
+// through Synth::postMidiEvent() with an audio thread rendering blocks.  A
+// producer that finds the queue full yields and tries again.  Prints the
+// wall time per event, as what matters here is how the threads get in each
+// other's way.
+//
+//   MidiQueue [producers]
+
+#include "BenchCommon.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace sfzero;
+
+static const int eventsPerProducer = 1000000;
+static const int queueSize = 1024;
+static const int numRuns = 3;
+static const int blockSize = 256;
+
+// Runs "numProducers" threads that each call push() with eventsPerProducer
+// events, retrying until it succeeds, while "consume" runs on this thread
+// until it returns false.  Returns the wall time taken.
+template <class Push, class Consume>
+static double runProducers(int numProducers, Push push, Consume consume)
+{
+  bench::Timer timer;
+  std::vector<std::thread> producers;
+  for (int p = 0; p < numProducers; ++p)
+  {
+    producers.emplace_back([p, &push] {
+      for (int i = 0; i < eventsPerProducer; ++i)
+      {
+        // Controller changes, so the synth has nothing to play.
+        MidiEvent event = {0, static_cast<uint8_t>(0xB0 | p), 1, static_cast<uint8_t>(i & 0x7F)};
+        while (!push(event))
+        {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  while (consume())
+  {
+  }
+  for (std::thread &producer : producers)
+  {
+    producer.join();
+  }
+  return timer.getSeconds();
+}
+
+static double benchQueue(int numProducers)
+{
+  MidiQueue queue;
+  queue.setCapacity(queueSize);
+  long numLeft = static_cast<long>(numProducers) * eventsPerProducer;
+  return runProducers(
+      numProducers, [&queue](const MidiEvent &event) { return queue.push(event); },
+      [&queue, &numLeft] {
+        MidiEvent event;
+        if (queue.pop(event))
+        {
+          numLeft -= 1;
+        }
+        else
+        {
+          std::this_thread::yield();
+        }
+        return numLeft > 0;
+      });
+}
+
+static double benchMutex(int numProducers)
+{
+  std::mutex lock;
+  std::vector<MidiEvent> queued, taken;
+  queued.reserve(queueSize);
+  taken.reserve(queueSize);
+  long numLeft = static_cast<long>(numProducers) * eventsPerProducer;
+  return runProducers(
+      numProducers,
+      [&](const MidiEvent &event) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (queued.size() >= queueSize)
+        {
+          return false;
+        }
+        queued.push_back(event);
+        return true;
+      },
+      [&] {
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          taken.swap(queued);
+        }
+        if (taken.empty())
+        {
+          std::this_thread::yield();
+        }
+        numLeft -= static_cast<long>(taken.size());
+        taken.clear();
+        return numLeft > 0;
+      });
+}
+
+static double benchSynth(int numProducers)
+{
+  Synth synth;
+  synth.setMidiQueueSize(queueSize);
+  synth.setCurrentPlaybackSampleRate(bench::sampleRate);
+  water::AudioSampleBuffer output(blockSize);
+  std::atomic<long> numLeft(static_cast<long>(numProducers) * eventsPerProducer);
+  return runProducers(
+      numProducers,
+      [&](const MidiEvent &event) {
+        if (!synth.postMidiEvent(event))
+        {
+          return false;
+        }
+        numLeft.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      },
+      [&] {
+        // Each block takes whatever has been posted since the last.  A real
+        // audio thread waits for its next callback in between.
+        synth.renderNextBlock(output, nullptr, 0, 0, blockSize);
+        std::this_thread::yield();
+        return numLeft.load(std::memory_order_relaxed) > 0;
+      });
+}
+
+int main(int argc, char **argv)
+{
+  int numProducers = (argc > 1) ? std::max(1, std::atoi(argv[1])) : 4;
+
+  // Best of several runs, interleaved.
+  double best[3] = {};
+  for (int run = 0; run < numRuns; ++run)
+  {
+    double seconds[3] = {benchQueue(numProducers), benchMutex(numProducers), benchSynth(numProducers)};
+    for (int i = 0; i < 3; ++i)
+    {
+      best[i] = (run == 0) ? seconds[i] : std::min(best[i], seconds[i]);
+    }
+  }
+
+  const char *names[3] = {"MidiQueue", "mutex+vector", "postMidiEvent"};
+  double numEvents = static_cast<double>(numProducers) * eventsPerProducer;
+  std::printf("%d producers, %d events each, %d-event queue, %u cores\n", numProducers, eventsPerProducer,
+              queueSize, std::thread::hardware_concurrency());
+  std::printf("queue          ns/event  M events/s\n");
+  for (int i = 0; i < 3; ++i)
+  {
+    std::printf("%-13s  %8.1f  %10.1f\n", names[i], best[i] * 1e9 / numEvents, numEvents / best[i] / 1e6);
+  }
+  return 0;
+}
@@ -0,0 +1,81 @@
+/*************************************************************************************
+ * Original code copyright (C) 2012 Steve Folta
+ * Converted to Juce module (C) 2016 Leo Olivers
+ * Forked from https://github.com/stevefolta/SFZero
+ * For license info please see the LICENSE file distributed with this source code
+ *************************************************************************************/
+
+// What starting a big chord costs: times a burst of note-ons started one
+// noteOn() at a time against the same burst through noteOns(), which looks
+// for free voices in one pass, for a few voice counts and chord sizes.
+//
+//   Tutti
+
+#include "BenchCommon.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace sfzero;
+
+static const int numRuns = 5;
+static const int chordsPerRun = 1000;
+
+int main()
+{
+  bench::SineLoader loader(44100, 1);
+  Sound::Ptr sound = bench::makeSound("<region> sample=sine.wav ampeg_release=0.001\n", loader);
+
+  std::printf("voices  chord  noteOn us  noteOns us  speedup\n");
+  const int voiceCounts[] = {256, 1024};
+  const int chordSizes[] = {16, 64};
+  for (int numVoices : voiceCounts)
+  {
+    for (int chordSize : chordSizes)
+    {
+      Synth synth;
+      for (int i = 0; i < numVoices; ++i)
+      {
+        synth.addVoice(new Voice());
+      }
+      synth.addSound(sound.get());
+      synth.setCurrentPlaybackSampleRate(bench::sampleRate);
+
+      std::vector<MidiEvent> chord;
+      for (int note = 0; note < chordSize; ++note)
+      {
+        MidiEvent event = {0, 0x90, static_cast<uint8_t>(30 + note), 100};
+        chord.push_back(event);
+      }
+
+      // Best of several runs, each alternating the two ways, and timing
+      // only the note-ons, not the all-notes-off between them.
+      double bestSingly = 0.0, bestBurst = 0.0;
+      for (int run = 0; run < numRuns; ++run)
+      {
+        double singly = 0.0, burst = 0.0;
+        for (int i = 0; i < chordsPerRun; ++i)
+        {
+          bench::Timer singlyTimer;
+          for (const MidiEvent &event : chord)
+          {
+            synth.noteOn(1, event.data1, event.data2 / 127.0f);
+          }
+          singly += singlyTimer.getSeconds();
+          synth.allNotesOff(0, false);
+
+          bench::Timer burstTimer;
+          synth.noteOns(chord.data(), chordSize);
+          burst += burstTimer.getSeconds();
+          synth.allNotesOff(0, false);
+        }
+        bestSingly = (run == 0) ? singly : std::min(bestSingly, singly);
+        bestBurst = (run == 0) ? burst : std::min(bestBurst, burst);
+      }
+
+      std::printf("%6d  %5d  %9.2f  %10.2f  %6.1fx\n", numVoices, chordSize, bestSingly * 1e6 / chordsPerRun,
+                  bestBurst * 1e6 / chordsPerRun, bestSingly / bestBurst);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,97 @@
+/*************************************************************************************
+ * Original code copyright (C) 2012 Steve Folta
+ * Converted to Juce module (C) 2016 Leo Olivers
+ * Forked from https://github.com/stevefolta/SFZero
+ * For license info please see the LICENSE file distributed with this source code
+ *************************************************************************************/
+
+// How the cost of a voice changes with the number playing: renders looping
+// voices in 256-frame blocks and prints the CPU time per voice per frame, and
+// how many such voices one core could keep up with in real time.
+//
+//   VoiceScaling [linear|hermite|sinc8|sinc16] [threads]
+
+#include "BenchCommon.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace sfzero;
+
+static const int blockSize = 256;
+static const double secondsRendered = 2.0;
+static const int numRuns = 5;
+// Each note starts this many voices, a few cents apart, so the voices read
+// the sample at different speeds, as a real mix would.
+static const int layersPerNote = 8;
+
+static std::string makeSfz()
+{
+  std::string sfz;
+  for (int layer = 0; layer < layersPerNote; ++layer)
+  {
+    sfz += "<region> sample=sine.wav loop_mode=loop_continuous loop_start=1000 loop_end=400000 "
+           "pitch_keycenter=60 tune=" +
+           std::to_string(layer * 3) + "\n";
+  }
+  return sfz;
+}
+
+int main(int argc, char **argv)
+{
+  const char *qualityNames[] = {"linear", "hermite", "sinc8", "sinc16"};
+  InterpolationQuality quality = interpolateLinear;
+  for (int i = 0; (argc > 1) && (i < 4); ++i)
+  {
+    if (std::strcmp(argv[1], qualityNames[i]) == 0)
+    {
+      quality = static_cast<InterpolationQuality>(i);
+    }
+  }
+  int numThreads = (argc > 2) ? std::atoi(argv[2]) : 0;
+
+  bench::SineLoader loader(441000, 2);
+  Sound::Ptr sound = bench::makeSound(makeSfz(), loader);
+  water::AudioSampleBuffer output(blockSize);
+  int numBlocks = static_cast<int>(secondsRendered * bench::sampleRate / blockSize);
+
+  std::printf("%s, %d worker threads, %d-frame blocks\n", qualityNames[quality], numThreads, blockSize);
+  std::printf("voices  ns/voice/frame  voices per core\n");
+  for (int numVoices = 16; numVoices <= 2048; numVoices *= 2)
+  {
+    // Best of several runs, each with fresh notes.
+    double best = 0.0;
+    int numPlaying = 0;
+    for (int run = 0; run < numRuns; ++run)
+    {
+      Synth synth;
+      // A few spare, so stealing never kicks in.
+      for (int i = 0; i < numVoices + 8; ++i)
+      {
+        synth.addVoice(new Voice());
+      }
+      synth.addSound(sound.get());
+      synth.setCurrentPlaybackSampleRate(bench::sampleRate);
+      synth.setInterpolationQuality(quality);
+      synth.setRenderThreads(numThreads, blockSize);
+      for (int note = 0; note < numVoices / layersPerNote; ++note)
+      {
+        synth.noteOn(1 + note / 16, 48 + note % 16, 1.0f);
+      }
+
+      bench::Timer timer;
+      for (int block = 0; block < numBlocks; ++block)
+      {
+        synth.renderNextBlock(output, nullptr, 0, 0, blockSize);
+      }
+      double seconds = timer.getCpuSeconds();
+      best = (run == 0) ? seconds : std::min(best, seconds);
+      numPlaying = synth.numVoicesUsed();
+    }
+
+    double voiceFrames = static_cast<double>(numPlaying) * numBlocks * blockSize;
+    std::printf("%6d  %14.2f  %15.0f\n", numPlaying, best * 1e9 / voiceFrames,
+                voiceFrames / bench::sampleRate / best);
+  }
+  return 0;
+}
@@ -7,12 +7,61 @@
 
 #include "SFZCommon.h"
 
+#include <errno.h>
 #include <math.h>
 #include <stdio.h>
 
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
 namespace sfzero
 {
 
+#if defined(_WIN32)
+Semaphore::Semaphore() : handle_(CreateSemaphore(nullptr, 0, 0x7fffffff, nullptr)) {}
+Semaphore::~Semaphore() { CloseHandle(handle_); }
+void Semaphore::signal(int count) { ReleaseSemaphore(handle_, count, nullptr); }
+void Semaphore::wait() { WaitForSingleObject(handle_, INFINITE); }
+#elif defined(__APPLE__)
+Semaphore::Semaphore() : handle_(0) { semaphore_create(mach_task_self(), &handle_, SYNC_POLICY_FIFO, 0); }
+Semaphore::~Semaphore() { semaphore_destroy(mach_task_self(), handle_); }
+void Semaphore::signal(int count)
+{
+  for (int i = 0; i < count; ++i)
+  {
+    semaphore_signal(handle_);
+  }
+}
+void Semaphore::wait()
+{
+  while (semaphore_wait(handle_) == KERN_ABORTED)
+  {
+  }
+}
+#else
+Semaphore::Semaphore() { sem_init(&handle_, 0, 0); }
+Semaphore::~Semaphore() { sem_destroy(&handle_); }
+void Semaphore::signal(int count)
+{
+  for (int i = 0; i < count; ++i)
+  {
+    sem_post(&handle_);
+  }
+}
+void Semaphore::wait()
+{
+  while (sem_wait(&handle_) != 0 && errno == EINTR)
+  {
+  }
+}
+#endif
+
 bool loadFileAsData(const std::string &file, MemoryBlock &mb)
 {
     FILE *fh = fopen(file.c_str(), "rb");
@@ -11,6 +11,13 @@
 
 #include <memory>
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 1))
+#include <xmmintrin.h>
+#define SFZ_FLUSH_DENORMALS_SSE 1
+#elif defined(__aarch64__) && defined(__GNUC__)
+#define SFZ_FLUSH_DENORMALS_AARCH64 1
+#endif
+
 #if defined(_MSC_VER)
 typedef signed __int64 int64_t;
 typedef unsigned __int64 uint64_t;
@@ -18,6 +25,10 @@ typedef unsigned __int64 uint64_t;
 #include <stdint.h>
 #endif
 
+#if !defined(_WIN32) && !defined(__APPLE__)
+#include <semaphore.h>
+#endif
+
 namespace sfzero
 {
 
@@ -27,6 +38,65 @@ struct MemoryBlock
   size_t size = 0;
 };
 
+// Has the FPU treat denormals as zero while in scope, so long release tails
+// don't fall onto the slow path.
+class ScopedFlushDenormals
+{
+public:
+#if defined(SFZ_FLUSH_DENORMALS_SSE)
+  // FTZ and DAZ.
+  ScopedFlushDenormals() : saved_(_mm_getcsr()) { _mm_setcsr(saved_ | 0x8040); }
+  ~ScopedFlushDenormals() { _mm_setcsr(saved_); }
+
+private:
+  unsigned int saved_;
+#elif defined(SFZ_FLUSH_DENORMALS_AARCH64)
+  // FZ.
+  ScopedFlushDenormals()
+  {
+    asm volatile("mrs %0, fpcr" : "=r"(saved_));
+    uint64_t flushing = saved_ | (1 << 24);
+    asm volatile("msr fpcr, %0" : : "r"(flushing));
+  }
+  ~ScopedFlushDenormals() { asm volatile("msr fpcr, %0" : : "r"(saved_)); }
+
+private:
+  uint64_t saved_;
+#else
+  ScopedFlushDenormals() {}
+#endif
+
+  ScopedFlushDenormals(const ScopedFlushDenormals &) = delete;
+  ScopedFlushDenormals &operator=(const ScopedFlushDenormals &) = delete;
+};
+
+// A counting semaphore on the OS's own, whose signal() takes no lock and
+// never blocks, so the audio thread can use it to wake other threads.  Only
+// those other threads wait().
+class Semaphore
+{
+public:
+  Semaphore();
+  ~Semaphore();
+
+  // Lets "count" waits through, now or later.
+  void signal(int count = 1);
+  void wait();
+
+private:
+#if defined(_WIN32)
+  void *handle_;
+#elif defined(__APPLE__)
+  // A mach semaphore; unnamed POSIX ones aren't supported there.
+  unsigned int handle_;
+#else
+  sem_t handle_;
+#endif
+
+  Semaphore(const Semaphore &) = delete;
+  Semaphore &operator=(const Semaphore &) = delete;
+};
+
 bool loadFileAsData(const std::string &file, MemoryBlock &mb);
 
 std::string getFileName(const std::string &file);
@@ -11,18 +11,65 @@ namespace sfzero
 
 static const float fastReleaseTime = 0.01f;
 
+void EGCoefficients::prepare(const EGParameters &parameters, double newSampleRate, bool newExponentialDecay)
+{
+  sampleRate = newSampleRate;
+  exponentialDecay = newExponentialDecay;
+
+  // Segments with no length are skipped, so their slopes don't matter.
+  delaySamples = static_cast<int>(parameters.delay * sampleRate);
+  attackSamples = static_cast<int>(parameters.attack * sampleRate);
+  attackSlope = (parameters.attack > 0) ? 1.0f / attackSamples : 0.0f;
+  holdSamples = static_cast<int>(parameters.hold * sampleRate);
+
+  decaySamples = static_cast<int>(parameters.decay * sampleRate);
+  decaySlope = 0.0f;
+  if ((parameters.decay > 0) && exponentialDecay)
+  {
+    // I don't truly understand this; just following what LinuxSampler does.
+    float mysterySlope = -9.226f / decaySamples;
+    decaySlope = exp(mysterySlope);
+    if (parameters.sustain > 0.0)
+    {
+      // Again, this is following LinuxSampler's example, which is similar to
+      // SF2-style decay, where "decay" specifies the time it would take to
+      // get to zero, not to the sustain level.  The SFZ spec is not that
+      // specific about what "decay" means, so perhaps it's really supposed
+      // to specify the time to reach the sustain level.
+      decaySamples = static_cast<int>(log(parameters.sustain / 100.0) / mysterySlope);
+    }
+  }
+  else if (parameters.decay > 0)
+  {
+    decaySlope = (parameters.sustain / 100.0f - 1.0f) / decaySamples;
+  }
+
+  float release = parameters.release;
+  if (release <= 0)
+  {
+    // Enforce a short release, to prevent clicks.
+    release = fastReleaseTime;
+  }
+  releaseSamples = static_cast<int>(release * sampleRate);
+  // A linear release's slope depends on the level it starts from.
+  releaseSlope = exponentialDecay ? exp(-9.226f / releaseSamples) : 0.0f;
+  fastReleaseSamples = static_cast<int>(fastReleaseTime * sampleRate);
+}
+
 EG::EG()
-    : segment_(), sampleRate_(0), exponentialDecay_(false), level_(0), slope_(0), samplesUntilNextSegment_(0), segmentIsExponential_(false)
+    : segment_(), exponentialDecay_(false), level_(0), slope_(0), samplesUntilNextSegment_(0), segmentIsExponential_(false)
 {
+  coefficients_.clear();
 }
 
 void EG::setExponentialDecay(bool newExponentialDecay) { exponentialDecay_ = newExponentialDecay; }
 
 void EG::startNote(const EGParameters *newParameters, float floatVelocity, double newSampleRate,
-                           const EGParameters *velMod)
+                           const EGParameters *velMod, const EGCoefficients *prepared)
 {
   parameters_ = *newParameters;
-  if (velMod)
+  bool velocityChangesParameters = velMod && (floatVelocity != 0.0f) && !velMod->isZero();
+  if (velocityChangesParameters)
   {
     parameters_.delay += floatVelocity * velMod->delay;
     parameters_.attack += floatVelocity * velMod->attack;
@@ -39,7 +86,16 @@ void EG::startNote(const EGParameters *newParameters, float floatVelocity, doubl
     }
     parameters_.release += floatVelocity * velMod->release;
   }
-  sampleRate_ = newSampleRate;
+
+  if (!velocityChangesParameters && prepared && (prepared->sampleRate == newSampleRate) &&
+      (prepared->exponentialDecay == exponentialDecay_))
+  {
+    coefficients_ = *prepared;
+  }
+  else
+  {
+    coefficients_.prepare(parameters_, newSampleRate, exponentialDecay_);
+  }
 
   startDelay();
 }
@@ -80,7 +136,7 @@ void EG::noteOff() { startRelease(); }
 void EG::fastRelease()
 {
   segment_ = Release;
-  samplesUntilNextSegment_ = static_cast<int>(fastReleaseTime * sampleRate_);
+  samplesUntilNextSegment_ = coefficients_.fastReleaseSamples;
   slope_ = -level_ / samplesUntilNextSegment_;
   segmentIsExponential_ = false;
 }
@@ -96,7 +152,7 @@ void EG::startDelay()
     segment_ = Delay;
     level_ = 0.0;
     slope_ = 0.0;
-    samplesUntilNextSegment_ = static_cast<int>(parameters_.delay * sampleRate_);
+    samplesUntilNextSegment_ = coefficients_.delaySamples;
     segmentIsExponential_ = false;
   }
 }
@@ -111,8 +167,8 @@ void EG::startAttack()
   {
     segment_ = Attack;
     level_ = parameters_.start / 100.0f;
-    samplesUntilNextSegment_ = static_cast<int>(parameters_.attack * sampleRate_);
-    slope_ = 1.0f / samplesUntilNextSegment_;
+    samplesUntilNextSegment_ = coefficients_.attackSamples;
+    slope_ = coefficients_.attackSlope;
     segmentIsExponential_ = false;
   }
 }
@@ -127,7 +183,7 @@ void EG::startHold()
   else
   {
     segment_ = Hold;
-    samplesUntilNextSegment_ = static_cast<int>(parameters_.hold * sampleRate_);
+    samplesUntilNextSegment_ = coefficients_.holdSamples;
     level_ = 1.0;
     slope_ = 0.0;
     segmentIsExponential_ = false;
@@ -143,32 +199,13 @@ void EG::startDecay()
   else
   {
     segment_ = Decay;
-    samplesUntilNextSegment_ = static_cast<int>(parameters_.decay * sampleRate_);
+    samplesUntilNextSegment_ = coefficients_.decaySamples;
     level_ = 1.0;
-    if (exponentialDecay_)
-    {
-      // I don't truly understand this; just following what LinuxSampler does.
-      float mysterySlope = -9.226f / samplesUntilNextSegment_;
-      slope_ = exp(mysterySlope);
-      segmentIsExponential_ = true;
-      if (parameters_.sustain > 0.0)
-      {
-        // Again, this is following LinuxSampler's example, which is similar to
-        // SF2-style decay, where "decay" specifies the time it would take to
-        // get to zero, not to the sustain level.  The SFZ spec is not that
-        // specific about what "decay" means, so perhaps it's really supposed
-        // to specify the time to reach the sustain level.
-        samplesUntilNextSegment_ = static_cast<int>(log((parameters_.sustain / 100.0) / level_) / mysterySlope);
-        if (samplesUntilNextSegment_ <= 0)
-        {
-          startSustain();
-        }
-      }
-    }
-    else
+    slope_ = coefficients_.decaySlope;
+    segmentIsExponential_ = coefficients_.exponentialDecay;
+    if (segmentIsExponential_ && (parameters_.sustain > 0.0) && (samplesUntilNextSegment_ <= 0))
     {
-      slope_ = (parameters_.sustain / 100.0f - 1.0f) / samplesUntilNextSegment_;
-      segmentIsExponential_ = false;
+      startSustain();
     }
   }
 }
@@ -191,21 +228,11 @@ void EG::startSustain()
 
 void EG::startRelease()
 {
-  float release = parameters_.release;
-
-  if (release <= 0)
-  {
-    // Enforce a short release, to prevent clicks.
-    release = fastReleaseTime;
-  }
-
   segment_ = Release;
-  samplesUntilNextSegment_ = static_cast<int>(release * sampleRate_);
-  if (exponentialDecay_)
+  samplesUntilNextSegment_ = coefficients_.releaseSamples;
+  if (coefficients_.exponentialDecay)
   {
-    // I don't truly understand this; just following what LinuxSampler does.
-    float mysterySlope = -9.226f / samplesUntilNextSegment_;
-    slope_ = exp(mysterySlope);
+    slope_ = coefficients_.releaseSlope;
     segmentIsExponential_ = true;
   }
   else
@@ -215,6 +242,4 @@ void EG::startRelease()
   }
 }
 
-const float EG::BottomLevel = 0.001f;
-
 }
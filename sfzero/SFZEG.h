@@ -20,12 +20,17 @@ public:
   virtual ~EG() {}
 
   void setExponentialDecay(bool newExponentialDecay);
-  void startNote(const EGParameters *parameters, float floatVelocity, double sampleRate, const EGParameters *velMod = nullptr);
+  // "prepared" are the coefficients for "parameters", if they've been worked
+  // out already.  They're used unless velocity changes the parameters.
+  void startNote(const EGParameters *parameters, float floatVelocity, double sampleRate,
+                 const EGParameters *velMod = nullptr, const EGCoefficients *prepared = nullptr);
   void nextSegment();
   void noteOff();
   void fastRelease();
   bool isDone() { return (segment_ == Done); }
   bool isReleasing() { return (segment_ == Release); }
+  // In the delay or attack, where the level is still on its way up.
+  bool isStarting() const { return (segment_ == Delay) || (segment_ == Attack); }
   int segmentIndex() { return static_cast<int>(segment_); }
   float getLevel() const { return level_; }
   void setLevel(float v) { level_ = v; }
@@ -57,13 +62,12 @@ private:
 
   Segment segment_;
   EGParameters parameters_;
-  double sampleRate_;
+  EGCoefficients coefficients_;
   bool exponentialDecay_;
   float level_;
   float slope_;
   int samplesUntilNextSegment_;
   bool segmentIsExponential_;
-  static const float BottomLevel;
   CARLA_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(EG)
 };
 }
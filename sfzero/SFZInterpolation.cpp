@@ -0,0 +1,135 @@
+/*************************************************************************************
+ * Original code copyright (C) 2012 Steve Folta
+ * Converted to Juce module (C) 2016 Leo Olivers
+ * Forked from https://github.com/stevefolta/SFZero
+ * For license info please see the LICENSE file distributed with this source code
+ *************************************************************************************/
+
+#include "SFZInterpolation.h"
+
+#include <cmath>
+
+namespace sfzero
+{
+
+static const double pi = 3.14159265358979323846;
+static const double kaiserBeta = 8.0;
+
+// Zeroth-order modified Bessel function of the first kind, for the Kaiser
+// window.
+static double besselI0(double x)
+{
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 50; ++k)
+  {
+    double halfXOverK = x / (2.0 * k);
+    term *= halfXOverK * halfXOverK;
+    sum += term;
+    if (term < sum * 1e-12)
+    {
+      break;
+    }
+  }
+  return sum;
+}
+
+double windowedSinc(double x, double cutoff, double halfWidth)
+{
+  double w = x / halfWidth;
+  if (w * w >= 1.0)
+  {
+    return 0.0;
+  }
+  double sinc = (x == 0.0) ? 1.0 : sin(pi * cutoff * x) / (pi * cutoff * x);
+  return cutoff * sinc * besselI0(kaiserBeta * sqrt(1.0 - w * w)) / besselI0(kaiserBeta);
+}
+
+// Longer kernels can afford a sharper transition band, so cut off closer to
+// Nyquist.
+SincTable::SincTable(int numTaps) : SincTable(numTaps, 1.0 - 1.0 / numTaps) {}
+
+SincTable::SincTable(int numTaps, double cutoff)
+    : numTaps_(numTaps), coefficients_(new float[(numPhases + 1) * numTaps])
+{
+  const double halfWidth = numTaps / 2;
+  const int tapsBefore = numTaps / 2 - 1;
+
+  for (int phase = 0; phase <= numPhases; ++phase)
+  {
+    double frac = static_cast<double>(phase) / numPhases;
+    float *row = &coefficients_[phase * numTaps];
+    double sum = 0.0;
+    for (int k = 0; k < numTaps; ++k)
+    {
+      double c = windowedSinc(k - tapsBefore - frac, cutoff, halfWidth);
+      row[k] = static_cast<float>(c);
+      sum += c;
+    }
+    // Normalize each row for unity gain at DC.
+    for (int k = 0; k < numTaps; ++k)
+    {
+      row[k] = static_cast<float>(row[k] / sum);
+    }
+  }
+}
+
+const SincTable &SincTable::get(int numTaps)
+{
+  static const SincTable sinc8(8);
+  static const SincTable sinc16(16);
+  return (numTaps > 8) ? sinc16 : sinc8;
+}
+
+void getInterpolationTaps(InterpolationQuality quality, int &tapsBefore, int &tapsAfter)
+{
+  switch (quality)
+  {
+  case interpolateHermite:
+    tapsBefore = HermiteInterpolator::tapsBefore;
+    tapsAfter = HermiteInterpolator::tapsAfter;
+    break;
+
+  case interpolateSinc8:
+    tapsBefore = SincInterpolator<8>::tapsBefore;
+    tapsAfter = SincInterpolator<8>::tapsAfter;
+    break;
+
+  case interpolateSinc16:
+    tapsBefore = SincInterpolator<16>::tapsBefore;
+    tapsAfter = SincInterpolator<16>::tapsAfter;
+    break;
+
+  case interpolateLinear:
+  default:
+    tapsBefore = LinearInterpolator::tapsBefore;
+    tapsAfter = LinearInterpolator::tapsAfter;
+    break;
+  }
+}
+
+void interpolateFrame(InterpolationQuality quality, const float *inL, const float *inR, int pos, float frac, float &l,
+                      float &r)
+{
+  switch (quality)
+  {
+  case interpolateHermite:
+    HermiteInterpolator()(inL, inR, pos, frac, l, r);
+    break;
+
+  case interpolateSinc8:
+    SincInterpolator<8>(SincTable::get(8))(inL, inR, pos, frac, l, r);
+    break;
+
+  case interpolateSinc16:
+    SincInterpolator<16>(SincTable::get(16))(inL, inR, pos, frac, l, r);
+    break;
+
+  case interpolateLinear:
+  default:
+    LinearInterpolator()(inL, inR, pos, frac, l, r);
+    break;
+  }
+}
+
+}
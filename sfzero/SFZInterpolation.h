@@ -0,0 +1,164 @@
+/*************************************************************************************
+ * Original code copyright (C) 2012 Steve Folta
+ * Converted to Juce module (C) 2016 Leo Olivers
+ * Forked from https://github.com/stevefolta/SFZero
+ * For license info please see the LICENSE file distributed with this source code
+ *************************************************************************************/
+#ifndef SFZINTERPOLATION_H_INCLUDED
+#define SFZINTERPOLATION_H_INCLUDED
+
+#include "SFZCommon.h"
+
+#include "CarlaJuceUtils.hpp"
+
+namespace sfzero
+{
+
+// How voices resample.  Per output frame and channel, linear reads 2 taps,
+// hermite 4, and the windowed sincs 8 or 16 (with their coefficients blended
+// from two table rows).  The cost grows more slowly than the taps, since each
+// voice's envelope and mixing cost the same at any quality.  Measured with
+// bench/Interpolation.cpp (64 looping voices, 256-frame blocks, one core of
+// a Xeon server at 44.1 kHz, best of 20 runs):
+//
+//   quality  ns/voice/frame  voices per core  x linear
+//   linear              4.6             4890       1.0
+//   hermite            11.8             1930       2.5
+//   sinc8              15.6             1460       3.4
+//   sinc16             20.0             1140       4.3
+enum InterpolationQuality
+{
+  interpolateLinear,
+  interpolateHermite,
+  interpolateSinc8,
+  interpolateSinc16
+};
+
+// The most taps any interpolator reads around a frame.
+static const int maxInterpolationTaps = 16;
+
+// Gets how many taps before and after the frame at "pos" an interpolator
+// reads.
+void getInterpolationTaps(InterpolationQuality quality, int &tapsBefore, int &tapsAfter);
+
+// Interpolates both channels at pos + frac, reading the taps around "pos".
+void interpolateFrame(InterpolationQuality quality, const float *inL, const float *inR, int pos, float frac, float &l,
+                      float &r);
+
+// A Kaiser-windowed sinc at x, with the cutoff relative to Nyquist and the
+// window reaching zero at +/- halfWidth.  Not normalized.
+double windowedSinc(double x, double cutoff, double halfWidth);
+
+// Kaiser-windowed sinc coefficients, tabulated for numPhases fractional
+// positions.  There's one extra row, so that any row can be blended with the
+// next one.
+class SincTable
+{
+public:
+  enum
+  {
+    numPhases = 256
+  };
+
+  explicit SincTable(int numTaps);
+  // "cutoff" is relative to Nyquist.
+  SincTable(int numTaps, double cutoff);
+
+  int getNumTaps() const { return numTaps_; }
+  const float *getRow(int phase) const { return &coefficients_[phase * numTaps_]; }
+
+  // The shared tables.  The first call builds them, so make it off the audio
+  // thread.
+  static const SincTable &get(int numTaps);
+
+private:
+  int numTaps_;
+  std::unique_ptr<float[]> coefficients_;
+
+  CARLA_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SincTable)
+};
+
+struct LinearInterpolator
+{
+  static const int tapsBefore = 0;
+  static const int tapsAfter = 1;
+
+  void operator()(const float *inL, const float *inR, int pos, float frac, float &l, float &r) const
+  {
+    float invFrac = 1.0f - frac;
+    l = inL[pos] * invFrac + inL[pos + 1] * frac;
+    r = inR[pos] * invFrac + inR[pos + 1] * frac;
+  }
+};
+
+// 4-point, 3rd-order Hermite.
+struct HermiteInterpolator
+{
+  static const int tapsBefore = 1;
+  static const int tapsAfter = 2;
+
+  static float interpolate(const float *x, float frac)
+  {
+    float c1 = 0.5f * (x[1] - x[-1]);
+    float c2 = x[-1] - 2.5f * x[0] + 2.0f * x[1] - 0.5f * x[2];
+    float c3 = 0.5f * (x[2] - x[-1]) + 1.5f * (x[0] - x[1]);
+    return ((c3 * frac + c2) * frac + c1) * frac + x[0];
+  }
+
+  void operator()(const float *inL, const float *inR, int pos, float frac, float &l, float &r) const
+  {
+    l = interpolate(inL + pos, frac);
+    r = interpolate(inR + pos, frac);
+  }
+};
+
+template <int numTaps>
+struct SincInterpolator
+{
+  static const int tapsBefore = numTaps / 2 - 1;
+  static const int tapsAfter = numTaps / 2;
+
+  explicit SincInterpolator(const SincTable &tableIn) : table(tableIn) {}
+
+  void operator()(const float *inL, const float *inR, int pos, float frac, float &l, float &r) const
+  {
+    float phase = frac * SincTable::numPhases;
+    int row = static_cast<int>(phase);
+    float blend = phase - row;
+    if (row >= SincTable::numPhases)
+    {
+      // frac rounded up to 1.
+      row = SincTable::numPhases - 1;
+      blend = 1.0f;
+    }
+    const float *c0 = table.getRow(row);
+    const float *c1 = c0 + numTaps;
+    const float *xl = inL + pos - tapsBefore;
+    const float *xr = inR + pos - tapsBefore;
+
+    // Fixed-length loops with four partial sums, which compilers turn into
+    // SIMD multiply-adds.
+    float c[numTaps];
+    for (int k = 0; k < numTaps; ++k)
+    {
+      c[k] = c0[k] + (c1[k] - c0[k]) * blend;
+    }
+    float sumL[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    float sumR[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (int k = 0; k < numTaps; k += 4)
+    {
+      for (int j = 0; j < 4; ++j)
+      {
+        sumL[j] += xl[k + j] * c[k + j];
+        sumR[j] += xr[k + j] * c[k + j];
+      }
+    }
+    l = (sumL[0] + sumL[1]) + (sumL[2] + sumL[3]);
+    r = (sumR[0] + sumR[1]) + (sumR[2] + sumR[3]);
+  }
+
+  const SincTable &table;
+};
+}
+
+#endif // SFZINTERPOLATION_H_INCLUDED
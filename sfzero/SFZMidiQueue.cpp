@@ -0,0 +1,86 @@
+/*************************************************************************************
+ * Original code copyright (C) 2012 Steve Folta
+ * Converted to Juce module (C) 2016 Leo Olivers
+ * Forked from https://github.com/stevefolta/SFZero
+ * For license info please see the LICENSE file distributed with this source code
+ *************************************************************************************/
+
+#include "SFZMidiQueue.h"
+
+namespace sfzero
+{
+
+MidiQueue::MidiQueue() : mask_(0), pushPosition_(0), popPosition_(0) { setCapacity(1); }
+
+void MidiQueue::setCapacity(int numEvents)
+{
+  uint32_t size = 1;
+  while (size < static_cast<uint32_t>(numEvents))
+  {
+    size <<= 1;
+  }
+
+  cells_.reset(new Cell[size]);
+  for (uint32_t i = 0; i < size; ++i)
+  {
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  mask_ = size - 1;
+  pushPosition_.store(0, std::memory_order_relaxed);
+  popPosition_ = 0;
+}
+
+bool MidiQueue::push(const MidiEvent &event)
+{
+  uint32_t position = pushPosition_.load(std::memory_order_relaxed);
+  Cell *cell;
+  for (;;)
+  {
+    cell = &cells_[position & mask_];
+    uint32_t sequence = cell->sequence.load(std::memory_order_acquire);
+    int32_t lag = static_cast<int32_t>(sequence - position);
+    if (lag == 0)
+    {
+      if (pushPosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (lag < 0)
+    {
+      // The consumer hasn't taken this cell's last event yet.
+      return false;
+    }
+    else
+    {
+      // Another producer took this position.
+      position = pushPosition_.load(std::memory_order_relaxed);
+    }
+  }
+
+  cell->event = event;
+  cell->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+bool MidiQueue::pop(MidiEvent &event)
+{
+  if (isEmpty())
+  {
+    return false;
+  }
+  Cell *cell = &cells_[popPosition_ & mask_];
+
+  event = cell->event;
+  cell->sequence.store(popPosition_ + mask_ + 1, std::memory_order_release);
+  popPosition_ += 1;
+  return true;
+}
+
+bool MidiQueue::isEmpty() const
+{
+  uint32_t sequence = cells_[popPosition_ & mask_].sequence.load(std::memory_order_acquire);
+  return static_cast<int32_t>(sequence - (popPosition_ + 1)) < 0;
+}
+
+}
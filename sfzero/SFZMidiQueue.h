@@ -0,0 +1,66 @@
+/*************************************************************************************
+ * Original code copyright (C) 2012 Steve Folta
+ * Converted to Juce module (C) 2016 Leo Olivers
+ * Forked from https://github.com/stevefolta/SFZero
+ * For license info please see the LICENSE file distributed with this source code
+ *************************************************************************************/
+#ifndef SFZMIDIQUEUE_H_INCLUDED
+#define SFZMIDIQUEUE_H_INCLUDED
+
+#include "SFZCommon.h"
+
+#include <atomic>
+#include <memory>
+
+namespace sfzero
+{
+
+// A short MIDI message, "time" frames into a block.
+struct MidiEvent
+{
+  int time;
+  uint8_t status, data1, data2;
+};
+
+// A fixed-size queue of MIDI events that any number of threads can push into
+// and one thread (the audio thread) pops from.  Neither side ever takes a
+// lock or allocates, and a full queue drops the event instead of waiting.
+// bench/MidiQueue.cpp measures it against a locked queue.
+class MidiQueue
+{
+public:
+  MidiQueue();
+
+  // Makes room for at least "numEvents" events, dropping any queued.  Not
+  // thread-safe.
+  void setCapacity(int numEvents);
+  int getCapacity() const { return static_cast<int>(mask_ + 1); }
+
+  // Returns false if the queue is full.
+  bool push(const MidiEvent &event);
+  // Only for the consumer thread.  Returns false if the queue is empty.
+  bool pop(MidiEvent &event);
+  // Whether pop() would find nothing.  Only for the consumer thread.
+  bool isEmpty() const;
+
+private:
+  // Each cell's sequence number says whose turn it is: the producer for
+  // position "p" when it's p, the consumer when it's p + 1.
+  struct Cell
+  {
+    std::atomic<uint32_t> sequence;
+    MidiEvent event;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  uint32_t mask_;
+  // Kept on separate cache lines, as producers and consumer hammer them from
+  // different cores.
+  alignas(64) std::atomic<uint32_t> pushPosition_;
+  alignas(64) uint32_t popPosition_;
+
+  CARLA_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MidiQueue)
+};
+}
+
+#endif // SFZMIDIQUEUE_H_INCLUDED
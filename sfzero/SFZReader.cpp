@@ -13,6 +13,9 @@
 namespace sfzero
 {
 
+// Keyswitches index key tables, so drop any that aren't MIDI keys.
+static int keyswitchValue(int key) { return ((key >= 0) && (key <= 127)) ? key : -1; }
+
 Reader::Reader(Sound *soundIn) : sound_(soundIn), line_(1) {}
 
 Reader::~Reader() {}
@@ -284,10 +287,66 @@ void Reader::read(const char *text, unsigned int length)
           {
             ivalue >> buildingRegion->group;
           }
+          else if (opcode == "seq_length")
+          {
+            ivalue >> buildingRegion->seq_length;
+          }
+          else if (opcode == "seq_position")
+          {
+            ivalue >> buildingRegion->seq_position;
+          }
+          else if (opcode == "sw_lokey")
+          {
+            buildingRegion->sw_lokey = keyswitchValue(keyValue(value));
+          }
+          else if (opcode == "sw_hikey")
+          {
+            buildingRegion->sw_hikey = keyswitchValue(keyValue(value));
+          }
+          else if (opcode == "sw_last")
+          {
+            buildingRegion->sw_last = keyswitchValue(keyValue(value));
+          }
+          else if (opcode == "sw_down")
+          {
+            buildingRegion->sw_down = keyswitchValue(keyValue(value));
+          }
+          else if (opcode == "sw_up")
+          {
+            buildingRegion->sw_up = keyswitchValue(keyValue(value));
+          }
+          else if (opcode == "sw_default")
+          {
+            buildingRegion->sw_default = keyswitchValue(keyValue(value));
+          }
+          else if (opcode == "lorand")
+          {
+            ivalue >> buildingRegion->lorand;
+          }
+          else if (opcode == "hirand")
+          {
+            ivalue >> buildingRegion->hirand;
+          }
           else if (opcode == "off_by" || opcode == "offby")
           {
             ivalue >> buildingRegion->off_by;
           }
+          else if (opcode == "polyphony")
+          {
+            // In a <group> or <global>, this limits the whole group.
+            if (buildingRegion == &curRegion)
+            {
+              ivalue >> buildingRegion->polyphony;
+            }
+            else
+            {
+              ivalue >> buildingRegion->group_polyphony;
+            }
+          }
+          else if (opcode == "note_polyphony")
+          {
+            ivalue >> buildingRegion->note_polyphony;
+          }
           else if (opcode == "offset")
           {
             ivalue >> buildingRegion->offset;
@@ -326,6 +385,10 @@ void Reader::read(const char *text, unsigned int length)
           {
             ivalue >> buildingRegion->loop_end;
           }
+          else if (opcode == "loop_crossfade")
+          {
+            ivalue >> buildingRegion->loop_crossfade;
+          }
           else if (opcode == "transpose")
           {
             ivalue >> buildingRegion->transpose;
@@ -362,6 +425,70 @@ void Reader::read(const char *text, unsigned int length)
           {
             ivalue >> buildingRegion->amp_veltrack;
           }
+          else if (opcode.compare(0, 13, "amp_velcurve_") == 0)
+          {
+            int velocity = -1;
+            std::istringstream(opcode.substr(13)) >> velocity;
+            if ((velocity >= 0) && (velocity <= 127))
+            {
+              ivalue >> buildingRegion->amp_velcurve[velocity];
+            }
+            else
+            {
+              sound_->addUnsupportedOpcode(opcode);
+            }
+          }
+          else if ((opcode.compare(0, 4, "locc") == 0) || (opcode.compare(0, 4, "hicc") == 0))
+          {
+            int cc = ccNumber(opcode, 4);
+            int ccValue = -1;
+            ivalue >> ccValue;
+            if ((cc >= 0) && (ccValue >= 0) && (ccValue <= 127))
+            {
+              uint8_t *range = (opcode[0] == 'l') ? buildingRegion->locc : buildingRegion->hicc;
+              range[cc] = static_cast<uint8_t>(ccValue);
+            }
+            else
+            {
+              sound_->addUnsupportedOpcode(opcode);
+            }
+          }
+          else if ((opcode.compare(0, 11, "volume_oncc") == 0) || (opcode.compare(0, 14, "amplitude_oncc") == 0) ||
+                   (opcode.compare(0, 8, "amp_oncc") == 0) || (opcode.compare(0, 8, "pan_oncc") == 0))
+          {
+            CCModulation::Target target = CCModulation::amplitude;
+            if (opcode[0] == 'v')
+            {
+              target = CCModulation::volume;
+            }
+            else if (opcode[0] == 'p')
+            {
+              target = CCModulation::pan;
+            }
+            int cc = ccNumber(opcode, opcode.find("oncc") + 4);
+            float amount = 0.0f;
+            ivalue >> amount;
+            if (cc < 0)
+            {
+              sound_->addUnsupportedOpcode(opcode);
+            }
+            else if (!buildingRegion->setCCModulation(target, cc, amount))
+            {
+              error("Too many CC modulations for one region");
+            }
+          }
+          else if (opcode == "amp_keytrack")
+          {
+            ivalue >> buildingRegion->amp_keytrack;
+          }
+          else if (opcode == "amp_keycenter")
+          {
+            buildingRegion->amp_keycenter = keyValue(value);
+          }
+          else if (opcode == "pitch_veltrack")
+          {
+            ivalue >> buildingRegion->pitch_veltrack;
+          }
           else if (opcode == "ampeg_delay")
           {
             ivalue >> buildingRegion->ampeg.delay;
@@ -604,6 +731,18 @@ int Reader::loopModeValue(const std::string &str)
   return Region::sample_loop;
 }
 
+int Reader::ccNumber(const std::string &opcode, size_t prefixLength)
+{
+  int cc = -1;
+  std::istringstream number(opcode.substr(prefixLength));
+  number >> cc;
+  if (!number || !number.eof() || (cc < 0) || (cc > 127))
+  {
+    return -1;
+  }
+  return cc;
+}
+
 void Reader::finishRegion(Region *region)
 {
   Region *newRegion = new Region();
@@ -34,6 +34,9 @@ private:
   int keyValue(const std::string &str);
   int triggerValue(const std::string &str);
   int loopModeValue(const std::string &str);
+  // The controller number that follows the first "prefixLength" characters
+  // of "opcode", or -1 if there isn't a valid one.
+  int ccNumber(const std::string &opcode, size_t prefixLength);
   void finishRegion(Region *region);
   void error(const std::string &message);
 
@@ -8,11 +8,15 @@
 #include "SFZRegion.h"
 #include "SFZSample.h"
 
+#include <algorithm>
+#include <cmath>
 #include <sstream>
 
 namespace sfzero
 {
 
+static const float globalGain = -1.0;
+
 void EGParameters::clear()
 {
   delay = 0.0;
@@ -30,6 +34,12 @@ void EGParameters::clearMod()
   delay = start = attack = hold = decay = sustain = release = 0.0;
 }
 
+bool EGParameters::isZero() const
+{
+  return (delay == 0.0f) && (start == 0.0f) && (attack == 0.0f) && (hold == 0.0f) && (decay == 0.0f) &&
+         (sustain == 0.0f) && (release == 0.0f);
+}
+
 Region::Region() { clear(); }
 
 void Region::clear()
@@ -40,8 +50,15 @@ void Region::clear()
     lovel = 0;
     trigger = attack;
     group = 0;
+    seq_length = 1;
+    seq_position = 1;
+    sw_lokey = sw_hikey = -1;
+    sw_last = sw_down = sw_up = sw_default = -1;
     off_by = 0;
     off_mode = fast;
+    polyphony = 0;
+    group_polyphony = 0;
+    note_polyphony = 0;
 
     offset = 0;
     end = 0;
@@ -49,6 +66,7 @@ void Region::clear()
     loop_mode = no_loop;
     loop_start = 0;
     loop_end = 0;
+    loop_crossfade = 0.0f;
     transpose = 0;
     tune = 0;
 #else
@@ -61,10 +79,179 @@ void Region::clear()
     pitch_keytrack = 100;
     bend_up = 200;
     bend_down = -200;
+    lorand = 0.0f;
+    hirand = 1.0f;
     volume = pan = 0.0f;
     amp_veltrack = 100.0f;
+    for (int i = 0; i < 128; ++i)
+    {
+      amp_velcurve[i] = -1.0f;
+    }
+    amp_keytrack = 0.0f;
+    amp_keycenter = 60;
+    pitch_veltrack = 0;
+    for (int i = 0; i < 128; ++i)
+    {
+      locc[i] = 0;
+      hicc[i] = 127;
+    }
+    cc_conditions = 0;
+    num_cc_modulations = 0;
+    velocity_gains = key_gains = nullptr;
+    volume_gain = 0.0f;
     ampeg.clear();
     ampeg_veltrack.clearMod();
+    prepared_rate = 0.0;
+    ampeg_coefficients.clear();
+    gain_left = gain_right = 0.0f;
+    index = 0;
+    group_index = 0;
+}
+
+static void applyPanLaw(double pan, float &left, float &right)
+{
+  // The SFZ spec is silent about the pan curve, but a 3dB pan law seems
+  // common.  This sqrt() curve matches what Dimension LE does; Alchemy Free
+  // seems closer to sin(adjustedPan * pi/2).
+  double adjustedPan = (std::min(std::max(pan, -100.0), 100.0) + 100.0) / 200.0;
+  left *= static_cast<float>(sqrt(1.0 - adjustedPan));
+  right *= static_cast<float>(sqrt(adjustedPan));
+}
+
+void Region::getPanGains(float &left, float &right) const
+{
+  left = right = computeVolumeGain();
+  applyPanLaw(pan, left, right);
+}
+
+void Region::getControllerGains(const uint8_t *controllers, float &left, float &right) const
+{
+  float gain = velocity_gains ? volume_gain : computeVolumeGain();
+  double panPosition = pan;
+  float amplitude = 0.0f;
+  bool amplitudeModulated = false;
+  for (int i = 0; i < num_cc_modulations; ++i)
+  {
+    const CCModulation &modulation = cc_modulations[i];
+    int value = controllers[modulation.cc];
+    switch (modulation.target)
+    {
+    case CCModulation::volume:
+      gain *= modulation.gains ? modulation.gains[value] : decibelsToGain(modulation.amount * value / 127.0f);
+      break;
+
+    case CCModulation::amplitude:
+      amplitude += modulation.amount * value / 127.0f;
+      amplitudeModulated = true;
+      break;
+
+    case CCModulation::pan:
+      panPosition += modulation.amount * value / 127.0;
+      break;
+    }
+  }
+  if (amplitudeModulated)
+  {
+    gain *= std::max(amplitude / 100.0f, 0.0f);
+  }
+  left = right = gain;
+  applyPanLaw(panPosition, left, right);
+}
+
+bool Region::setCCModulation(CCModulation::Target target, int cc, float amount)
+{
+  for (int i = 0; i < num_cc_modulations; ++i)
+  {
+    if ((cc_modulations[i].target == target) && (cc_modulations[i].cc == cc))
+    {
+      cc_modulations[i].amount = amount;
+      cc_modulations[i].gains = nullptr;
+      return true;
+    }
+  }
+  if (num_cc_modulations >= maxCCModulations)
+  {
+    return false;
+  }
+  CCModulation &modulation = cc_modulations[num_cc_modulations++];
+  modulation.target = target;
+  modulation.cc = cc;
+  modulation.amount = amount;
+  modulation.gains = nullptr;
+  return true;
+}
+
+uint64_t Region::getLoopCrossfadeFrames(int64_t loopStart, int64_t loopEnd) const
+{
+  if ((sample == nullptr) || (loop_crossfade <= 0.0f))
+  {
+    return 0;
+  }
+  int64_t frames = static_cast<int64_t>(loop_crossfade * sample->getSampleRate() + 0.5);
+  frames = std::min(frames, std::min(loopStart, loopEnd + 1 - loopStart));
+  return static_cast<uint64_t>(std::max<int64_t>(frames, 0));
+}
+
+float Region::computeVelocityGain(int velocity) const
+{
+  double track = amp_veltrack / 100.0;
+
+  // Find the amp_velcurve_N points either side.  The curve runs from 0 at
+  // velocity 0 to 1 at velocity 127 unless those points are given.
+  int below = -1, above = -1;
+  for (int i = velocity; i >= 0; --i)
+  {
+    if (amp_velcurve[i] >= 0.0f)
+    {
+      below = i;
+      break;
+    }
+  }
+  for (int i = velocity; i < 128; ++i)
+  {
+    if (amp_velcurve[i] >= 0.0f)
+    {
+      above = i;
+      break;
+    }
+  }
+
+  if ((below < 0) && (above < 0))
+  {
+    // Thanks to <http:://www.drealm.info/sfz/plj-sfz.xhtml> for explaining the
+    // velocity curve in a way that I could understand, although they mean
+    // "log10" when they say "log".
+    double velocityGainDB = -20.0 * log10((127.0 * 127.0) / (velocity * velocity));
+    return decibelsToGain(velocityGainDB * track);
+  }
+
+  double belowValue = (below < 0) ? 0.0 : amp_velcurve[below];
+  double aboveValue = (above < 0) ? 1.0 : amp_velcurve[above];
+  below = std::max(below, 0);
+  above = (above < 0) ? 127 : above;
+  double curve = belowValue;
+  if (above > below)
+  {
+    curve += (aboveValue - belowValue) * (velocity - below) / (above - below);
+  }
+  if (track < 0.0)
+  {
+    curve = 1.0 - curve;
+    track = -track;
+  }
+  return static_cast<float>(1.0 - track + track * curve);
+}
+
+float Region::computeKeyGain(int note) const { return decibelsToGain(amp_keytrack * (note - amp_keycenter)); }
+
+float Region::computeVolumeGain() const { return decibelsToGain(globalGain + volume); }
+
+void Region::prepare(double sampleRate)
+{
+  // Voices always use exponential decay.
+  ampeg_coefficients.prepare(ampeg, sampleRate, true);
+  getPanGains(gain_left, gain_right);
+  prepared_rate = sampleRate;
 }
 
 std::string Region::dump()
@@ -80,6 +267,44 @@ std::string Region::dump()
   return info.str();
 }
 
+bool Region::getLoopPoints(int64_t &loopStartOut, int64_t &loopEndOut) const
+{
+  loopStartOut = loopEndOut = 0;
+  if (sample == nullptr)
+  {
+    return false;
+  }
+
+  LoopMode loopMode = loop_mode;
+  if (loopMode == sample_loop)
+  {
+    if (sample->getLoopStart() < sample->getLoopEnd())
+    {
+      loopMode = loop_continuous;
+    }
+    else
+    {
+      loopMode = no_loop;
+    }
+  }
+  if ((loopMode == no_loop) || (loopMode == one_shot))
+  {
+    return false;
+  }
+
+  if (loop_start < loop_end)
+  {
+    loopStartOut = loop_start;
+    loopEndOut = loop_end;
+  }
+  else
+  {
+    loopStartOut = sample->getLoopStart();
+    loopEndOut = sample->getLoopEnd();
+  }
+  return loopStartOut < loopEndOut;
+}
+
 float Region::timecents2Secs(int timecents) { return static_cast<float>(pow(2.0, timecents / 1200.0)); }
 
 }
@@ -9,6 +9,8 @@
 
 #include "SFZCommon.h"
 
+#include <bitset>
+
 namespace sfzero
 {
 
@@ -22,6 +24,44 @@ struct EGParameters
 
   void clear();
   void clearMod();
+  bool isZero() const;
+};
+
+// EG segment lengths and slopes worked out for one set of parameters at one
+// sample rate, so starting a note doesn't have to.
+struct EGCoefficients
+{
+  double sampleRate; // Zero if not prepared.
+  bool exponentialDecay;
+  int delaySamples, attackSamples, holdSamples, decaySamples, releaseSamples, fastReleaseSamples;
+  float attackSlope, decaySlope, releaseSlope;
+
+  void clear() { sampleRate = 0.0; }
+  void prepare(const EGParameters &parameters, double newSampleRate, bool newExponentialDecay);
+};
+
+// A region setting moved by a MIDI controller, from volume_onccN,
+// amplitude_onccN or pan_onccN.  Each adds "amount" in proportion to the
+// controller's value (0 to 1) to its setting: volume in dB, pan, or, as in
+// the ARIA extensions, an amplitude in percent that starts from zero.  If a
+// region has any amplitude modulations, their total scales its gain, so
+// amplitude_oncc11=100 makes CC 11 a linear fader.
+struct CCModulation
+{
+  enum Target
+  {
+    volume,
+    amplitude,
+    pan
+  };
+
+  Target target;
+  int cc;
+  float amount;
+  // For volume: the gain for each controller value, shared like the
+  // region's velocity gains.  Set by Sound::buildGainTables(); null until
+  // then.
+  const float *gains;
 };
 
 struct Region
@@ -53,25 +93,83 @@ struct Region
   void clear();
   std::string dump();
 
-  bool matches(int note, int velocity, Trigger trig)
+  // Gets the loop this region plays, if it loops at all.  loopEnd is
+  // inclusive.
+  bool getLoopPoints(int64_t &loopStart, int64_t &loopEnd) const;
+  // loop_crossfade in frames of the sample, shortened to fit the loop and
+  // the frames before it.
+  uint64_t getLoopCrossfadeFrames(int64_t loopStart, int64_t loopEnd) const;
+
+  // The note gain for each side, from the volume and pan, before velocity.
+  void getPanGains(float &left, float &right) const;
+  // The same, with the CC modulation applied for the controller values in
+  // "controllers".
+  void getControllerGains(const uint8_t *controllers, float &left, float &right) const;
+  // Sets the amount for a modulation of "target" by "cc", replacing any
+  // already given.  Returns false if the region has no room for another.
+  bool setCCModulation(CCModulation::Target target, int cc, float amount);
+  // The gain for a velocity, from amp_veltrack and amp_velcurve_N, and for a
+  // key, from amp_keytrack.  Sound bakes these into velocity_gains and
+  // key_gains.
+  float computeVelocityGain(int velocity) const;
+  float computeKeyGain(int note) const;
+  // The gain from "volume", with the global gain.  Sound bakes this into
+  // volume_gain.
+  float computeVolumeGain() const;
+
+  // Works out the constants below for playback at "sampleRate".
+  void prepare(double sampleRate);
+
+  bool matches(int note, int velocity, Trigger trig) const
   {
     return (note >= lokey && note <= hikey && velocity >= lovel && velocity <= hivel &&
             (trig == this->trigger || (this->trigger == attack && (trig == first || trig == legato))));
   }
 
+  // Whether the region's turn in its round robin comes up on the
+  // "sequence"th note on its key (counting from zero), and whether
+  // "random" (0 to 1) falls in its lorand to hirand range.
+  bool matchesSequence(unsigned int sequence) const
+  {
+    return (seq_length <= 1) || (static_cast<int>(sequence % seq_length) == seq_position - 1);
+  }
+  bool matchesRandom(float random) const { return (random >= lorand) && (random < hirand); }
+  // Whether the region's articulation is the one picked by "lastKeyswitch",
+  // the last keyswitch pressed, or -1 if none has been.
+  bool matchesKeyswitch(int lastKeyswitch) const
+  {
+    return (sw_last < 0) || (sw_last == ((lastKeyswitch >= 0) ? lastKeyswitch : sw_default));
+  }
+  bool matchesKeysDown(const std::bitset<128> &keysDown) const
+  {
+    return ((sw_down < 0) || keysDown.test(sw_down)) && ((sw_up < 0) || !keysDown.test(sw_up));
+  }
+
   Sample *sample;
   int lokey, hikey;
   int lovel, hivel;
   Trigger trigger;
   int group;
+  int seq_length, seq_position;
+  float lorand, hirand;
+  // Keyswitches, or -1 where not given.  Keys from sw_lokey to sw_hikey, and
+  // sw_last keys, switch articulations.  The region plays after its sw_last
+  // key is pressed, or before any is if that's sw_default, and while sw_down
+  // is held and sw_up isn't.
+  int sw_lokey, sw_hikey, sw_last, sw_down, sw_up, sw_default;
   int64_t off_by;
   OffMode off_mode;
+  // Voice limits for this region, for its group, and for each note within
+  // its group.  Zero means no limit.
+  int polyphony, group_polyphony, note_polyphony;
 
   int64_t offset;
   int64_t end;
   bool negative_end;
   LoopMode loop_mode;
   int64_t loop_start, loop_end;
+  // In seconds.
+  float loop_crossfade;
   int transpose;
   int tune;
   int pitch_keycenter, pitch_keytrack;
@@ -79,9 +177,44 @@ struct Region
 
   float volume, pan;
   float amp_veltrack;
+  // amp_velcurve_N points, or -1 where none was given.
+  float amp_velcurve[128];
+  float amp_keytrack;
+  int amp_keycenter;
+  int pitch_veltrack;
+
+  // The region only plays notes started while each controller is within
+  // locc_N to hicc_N.
+  uint8_t locc[128], hicc[128];
+  // Sound::buildCCConditions() numbers the different controller ranges its
+  // regions ask for; these are the bits for the ones this region needs.
+  uint64_t cc_conditions;
+
+  enum
+  {
+    maxCCModulations = 16
+  };
+  CCModulation cc_modulations[maxCCModulations];
+  int num_cc_modulations;
 
   EGParameters ampeg, ampeg_veltrack;
 
+  // Gains by velocity and by key, shared between regions where they're the
+  // same, and the gain "volume" gives, with the global gain.  Set by
+  // Sound::buildGainTables(); null until then.
+  const float *velocity_gains, *key_gains;
+  float volume_gain;
+
+  // Set by prepare(), for playback at prepared_rate (zero if not prepared).
+  double prepared_rate;
+  EGCoefficients ampeg_coefficients;
+  float gain_left, gain_right;
+
+  // Set by Sound::addRegion(): the region's position in the sound, and a
+  // dense index for its group number, for Synth's per-region and per-group
+  // voice lists.
+  int index, group_index;
+
   static float timecents2Secs(int timecents);
 };
 
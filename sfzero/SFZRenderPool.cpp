@@ -0,0 +1,311 @@
+/*************************************************************************************
+ * Original code copyright (C) 2012 Steve Folta
+ * Converted to Juce module (C) 2016 Leo Olivers
+ * Forked from https://github.com/stevefolta/SFZero
+ * For license info please see the LICENSE file distributed with this source code
+ *************************************************************************************/
+
+#include "SFZRenderPool.h"
+#include "SFZVoice.h"
+
+#include <cstring>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace sfzero
+{
+
+// Layout of claim_: job id in the top 32 bits, then the number of voices, then
+// the index of the next voice to take.
+static const int claimCountShift = 16;
+static const uint64_t claimFieldMask = 0xffff;
+static const int maxJobVoices = 0xffff;
+
+// An idle worker yields this many times before it goes to sleep.
+static const int workerYieldRounds = 1000;
+
+static void pinThread(std::thread &thread, int index)
+{
+#if defined(__linux__)
+  // Spread the workers over the cores after the first.
+  unsigned numCores = std::thread::hardware_concurrency();
+  if (numCores < 2)
+  {
+    return;
+  }
+  cpu_set_t cores;
+  CPU_ZERO(&cores);
+  CPU_SET(1 + index % (numCores - 1), &cores);
+  pthread_setaffinity_np(thread.native_handle(), sizeof(cores), &cores);
+#else
+  (void)thread;
+  (void)index;
+#endif
+}
+
+// The calling thread's scheduling policy and priority, packed into 32 bits,
+// or -1 if they can't be read.
+static int64_t getThreadScheduling()
+{
+#if defined(_WIN32)
+  int priority = GetThreadPriority(GetCurrentThread());
+  if (priority == THREAD_PRIORITY_ERROR_RETURN)
+  {
+    return -1;
+  }
+  return static_cast<uint16_t>(priority);
+#else
+  int policy;
+  sched_param param;
+  if (pthread_getschedparam(pthread_self(), &policy, &param) != 0)
+  {
+    return -1;
+  }
+  return (static_cast<int64_t>(policy & 0xffff) << 16) | static_cast<uint16_t>(param.sched_priority);
+#endif
+}
+
+static void setThreadScheduling(uint32_t scheduling)
+{
+  // Without the rights to, the worker just keeps its own.
+#if defined(_WIN32)
+  SetThreadPriority(GetCurrentThread(), static_cast<int16_t>(scheduling & 0xffff));
+#else
+  sched_param param = sched_param();
+  param.sched_priority = static_cast<int16_t>(scheduling & 0xffff);
+  pthread_setschedparam(pthread_self(), static_cast<int>(scheduling >> 16), &param);
+#endif
+}
+
+RenderPool::RenderPool()
+    : maxFrames_(0), quit_(false), numParked_(0), audioScheduling_(0), claim_(0), numDone_(0), jobId_(0),
+      jobVoices_(nullptr), jobLeft_(nullptr), jobRight_(nullptr), jobFrames_(0)
+{
+}
+
+RenderPool::~RenderPool() { stop(); }
+
+void RenderPool::start(int numThreads, int maxFrames)
+{
+  stop();
+  if (numThreads <= 0 || maxFrames <= 0)
+  {
+    return;
+  }
+
+  maxFrames_ = maxFrames;
+  quit_.store(false);
+  for (int i = 0; i < numThreads; ++i)
+  {
+    std::unique_ptr<Worker> worker(new Worker());
+    worker->scratch.reset(new float[2 * maxFrames]);
+    worker->mixedJob = jobId_;
+    worker->scheduling = 0;
+    workers_.push_back(std::move(worker));
+  }
+  for (int i = 0; i < numThreads; ++i)
+  {
+    Worker *worker = workers_[i].get();
+    worker->thread = std::thread([this, worker] { run(worker); });
+    pinThread(worker->thread, i);
+  }
+}
+
+void RenderPool::stop()
+{
+  quit_.store(true);
+  wakeSignal_.signal(static_cast<int>(workers_.size()));
+  for (size_t i = 0; i < workers_.size(); ++i)
+  {
+    workers_[i]->thread.join();
+  }
+  workers_.clear();
+  maxFrames_ = 0;
+}
+
+void RenderPool::render(Voice *const *voices, int numVoices, float *outL, float *outR, int numFrames)
+{
+  // Anything past what claim_ can count is done here.
+  for (; numVoices > maxJobVoices; --numVoices)
+  {
+    voices[numVoices - 1]->renderNextBlock(outL, outR, numFrames);
+  }
+  if (numVoices <= 0)
+  {
+    return;
+  }
+
+  // Reading the scheduling can take a lock inside the OS library, so only
+  // when a new thread starts calling.
+  std::thread::id caller = std::this_thread::get_id();
+  if (caller != audioThread_)
+  {
+    audioThread_ = caller;
+    int64_t scheduling = getThreadScheduling();
+    if (scheduling >= 0)
+    {
+      uint64_t changes = (audioScheduling_.load(std::memory_order_relaxed) >> 32) + 1;
+      audioScheduling_.store((changes << 32) | static_cast<uint64_t>(scheduling), std::memory_order_relaxed);
+    }
+  }
+
+  jobVoices_ = voices;
+  jobLeft_ = outL;
+  jobRight_ = outR;
+  jobFrames_ = numFrames;
+  numDone_.store(0, std::memory_order_relaxed);
+  jobId_ += 1;
+  claim_.store((static_cast<uint64_t>(jobId_) << 32) | (static_cast<uint64_t>(numVoices) << claimCountShift));
+
+  // A worker counts itself as parked before it last looks at claim_, so
+  // either it sees this job or we see it and wake it.
+  if (numParked_.load() > 0)
+  {
+    int numWoken = numParked_.exchange(0);
+    if (numWoken > 0)
+    {
+      wakeSignal_.signal(numWoken);
+    }
+  }
+
+  // Every voice no worker has taken yet is rendered here.
+  renderClaimed(nullptr);
+
+  // The voices still out are being rendered right now, by workers running
+  // at our priority, so this is a short wait.
+  while (numDone_.load(std::memory_order_acquire) < numVoices)
+  {
+    std::this_thread::yield();
+  }
+
+  for (size_t i = 0; i < workers_.size(); ++i)
+  {
+    Worker *worker = workers_[i].get();
+    if (worker->mixedJob != jobId_)
+    {
+      continue;
+    }
+    const float *scratchL = worker->scratch.get();
+    const float *scratchR = scratchL + maxFrames_;
+    for (int j = 0; j < numFrames; ++j)
+    {
+      outL[j] += scratchL[j];
+    }
+    if (outR)
+    {
+      for (int j = 0; j < numFrames; ++j)
+      {
+        outR[j] += scratchR[j];
+      }
+    }
+  }
+}
+
+void RenderPool::renderClaimed(Worker *worker)
+{
+  uint64_t claim = claim_.load(std::memory_order_acquire);
+  for (;;)
+  {
+    uint64_t next = claim & claimFieldMask;
+    uint64_t count = (claim >> claimCountShift) & claimFieldMask;
+    if (next >= count)
+    {
+      return;
+    }
+    // The job id makes this fail if the job has been replaced since "claim"
+    // was read, even if the new one has reached the same voice.
+    if (!claim_.compare_exchange_weak(claim, claim + 1, std::memory_order_acquire, std::memory_order_acquire))
+    {
+      continue;
+    }
+
+    // The voice is ours, so the job can't finish (or change) until it's done.
+    float *outL = jobLeft_;
+    float *outR = jobRight_;
+    if (worker)
+    {
+      uint32_t job = static_cast<uint32_t>(claim >> 32);
+      outL = worker->scratch.get();
+      outR = jobRight_ ? outL + maxFrames_ : nullptr;
+      if (worker->mixedJob != job)
+      {
+        std::memset(outL, 0, sizeof(float) * jobFrames_);
+        std::memset(outL + maxFrames_, 0, sizeof(float) * jobFrames_);
+        worker->mixedJob = job;
+      }
+    }
+    jobVoices_[next]->renderNextBlock(outL, outR, jobFrames_);
+    numDone_.fetch_add(1, std::memory_order_release);
+
+    claim = claim_.load(std::memory_order_acquire);
+  }
+}
+
+bool RenderPool::hasUnclaimedWork() const
+{
+  uint64_t claim = claim_.load();
+  return (claim & claimFieldMask) < ((claim >> claimCountShift) & claimFieldMask);
+}
+
+void RenderPool::park()
+{
+  numParked_.fetch_add(1);
+  if (quit_.load() || hasUnclaimedWork())
+  {
+    // Take our count back, unless render() already took it, and signalled
+    // for it.  Any parked worker's count will do; the signals are the same.
+    int parked = numParked_.load();
+    while (parked > 0 && !numParked_.compare_exchange_weak(parked, parked - 1))
+    {
+    }
+    if (parked > 0)
+    {
+      return;
+    }
+  }
+  // Wakeups can be early, but run() looks for work again anyway.
+  wakeSignal_.wait();
+}
+
+void RenderPool::run(Worker *worker)
+{
+  // For the worker's whole life, rather than each voice.
+  ScopedFlushDenormals flushDenormals;
+  int idleRounds = 0;
+  while (!quit_.load(std::memory_order_relaxed))
+  {
+    uint64_t scheduling = audioScheduling_.load(std::memory_order_relaxed);
+    if (scheduling != worker->scheduling)
+    {
+      worker->scheduling = scheduling;
+      setThreadScheduling(static_cast<uint32_t>(scheduling));
+    }
+
+    uint32_t lastJob = worker->mixedJob;
+    renderClaimed(worker);
+    if (worker->mixedJob != lastJob)
+    {
+      idleRounds = 0;
+    }
+    else if (idleRounds < workerYieldRounds)
+    {
+      idleRounds += 1;
+      std::this_thread::yield();
+    }
+    else
+    {
+      park();
+      idleRounds = 0;
+    }
+  }
+}
+
+}
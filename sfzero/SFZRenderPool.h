@@ -0,0 +1,99 @@
+/*************************************************************************************
+ * Original code copyright (C) 2012 Steve Folta
+ * Converted to Juce module (C) 2016 Leo Olivers
+ * Forked from https://github.com/stevefolta/SFZero
+ * For license info please see the LICENSE file distributed with this source code
+ *************************************************************************************/
+#ifndef SFZRENDERPOOL_H_INCLUDED
+#define SFZRENDERPOOL_H_INCLUDED
+
+#include "SFZCommon.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace sfzero
+{
+
+class Voice;
+
+// A fixed set of worker threads that help the audio thread render voices.
+// Each worker mixes the voices it takes into its own stereo scratch buffer,
+// and the audio thread adds those into the output once every voice is done.
+// Workers that have been idle for a while sleep until render() wakes them
+// through a semaphore.  render() allocates nothing and takes no locks, except
+// the first time a thread calls it: the workers take on that thread's
+// scheduling policy and priority, where the OS allows it, so that one holding
+// a voice the audio thread waits for isn't preempted by ordinary threads.
+class RenderPool
+{
+public:
+  RenderPool();
+  ~RenderPool();
+
+  // Starts "numThreads" workers that can take blocks of up to "maxFrames"
+  // frames, stopping any that were already running.  Not for the audio
+  // thread.
+  void start(int numThreads, int maxFrames);
+  void stop();
+
+  int getNumThreads() const { return static_cast<int>(workers_.size()); }
+  int getMaxFrames() const { return maxFrames_; }
+
+  // Renders the voices into outL/outR (outR can be null), sharing them out
+  // between the audio thread and the workers.  "numFrames" must be no more
+  // than getMaxFrames().
+  void render(Voice *const *voices, int numVoices, float *outL, float *outR, int numFrames);
+
+private:
+  struct Worker
+  {
+    std::thread thread;
+    std::unique_ptr<float[]> scratch;
+    // The job whose voices are in "scratch".  Written by the worker, read by
+    // the audio thread once the job is done.
+    uint32_t mixedJob;
+    // The last of audioScheduling_ the worker took on.
+    uint64_t scheduling;
+  };
+
+  // Takes voices from the current job until there are none left.  A null
+  // worker means the audio thread, which mixes straight into the output.
+  void renderClaimed(Worker *worker);
+  bool hasUnclaimedWork() const;
+  // Puts an idle worker to sleep until there's work or it's time to quit.
+  void park();
+  void run(Worker *worker);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  int maxFrames_;
+  std::atomic<bool> quit_;
+
+  // Sleeping workers, and those on their way to sleep.  render() signals
+  // wakeSignal_ once for each worker it takes off numParked_.
+  Semaphore wakeSignal_;
+  std::atomic<int> numParked_;
+
+  // The scheduling of the thread that last called render(), with a count of
+  // changes in the top 32 bits so the workers notice each one.  Zero until
+  // it's known.
+  std::thread::id audioThread_;
+  std::atomic<uint64_t> audioScheduling_;
+
+  // The job id, the number of voices and the next voice to take, packed
+  // together so a worker can't take a voice from a job that has moved on.
+  std::atomic<uint64_t> claim_;
+  std::atomic<int> numDone_;
+  uint32_t jobId_;
+
+  // Only read by whoever has taken a voice of the current job.
+  Voice *const *jobVoices_;
+  float *jobLeft_, *jobRight_;
+  int jobFrames_;
+
+  CARLA_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RenderPool)
+};
+}
+
+#endif // SFZRENDERPOOL_H_INCLUDED
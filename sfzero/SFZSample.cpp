@@ -8,10 +8,130 @@
 #include "SFZSample.h"
 #include "SFZSampleLoader.h"
 #include "SFZDebug.h"
+#include "SFZInterpolation.h"
+
+#include <algorithm>
+#include <cmath>
 
 namespace sfzero
 {
 
+// Loops up to this long get unrolled, into at least unrolledLoopMinLength
+// frames.
+static const uint64_t unrolledLoopMaxLength = 2048;
+static const uint64_t unrolledLoopMinLength = 4096;
+
+// Length of the offline resampling kernel.
+static const int resamplingTaps = 64;
+
+// Half-band lowpass used for each halving of the sample rate.
+static const int halfBandTaps = 31;
+
+static const double halfPi = 1.57079632679489661923;
+
+static void makeHalfBandCoefficients(float *coefficients)
+{
+  const int center = halfBandTaps / 2;
+  double sum = 0.0;
+  for (int k = 0; k < halfBandTaps; ++k)
+  {
+    double c = windowedSinc(k - center, 0.5, center + 1);
+    coefficients[k] = static_cast<float>(c);
+    sum += c;
+  }
+  for (int k = 0; k < halfBandTaps; ++k)
+  {
+    coefficients[k] = static_cast<float>(coefficients[k] / sum);
+  }
+}
+
+static void decimateByTwo(const SampleBuffer &in, SampleBuffer &out)
+{
+  const int center = halfBandTaps / 2;
+  float coefficients[halfBandTaps];
+  makeHalfBandCoefficients(coefficients);
+
+  out.sampleRate = in.sampleRate / 2;
+  out.sampleLength = (in.sampleLength + 1) / 2;
+  out.loopStart = in.loopStart / 2;
+  out.loopEnd = in.loopEnd / 2;
+  out.numChannels = in.numChannels;
+  out.samples.reset(new float[out.sampleLength * out.numChannels]);
+
+  const int64_t inLength = static_cast<int64_t>(in.sampleLength);
+  for (unsigned int channel = 0; channel < in.numChannels; ++channel)
+  {
+    const float *x = in.getReadPointer(channel);
+    float *y = &out.samples[channel * out.sampleLength];
+    for (int64_t n = 0; n < static_cast<int64_t>(out.sampleLength); ++n)
+    {
+      // The signal is taken to be silent outside the sample.
+      float acc = 0.0f;
+      for (int k = 0; k < halfBandTaps; ++k)
+      {
+        int64_t i = 2 * n + k - center;
+        if ((i >= 0) && (i < inLength))
+        {
+          acc += x[i] * coefficients[k];
+        }
+      }
+      y[n] = acc;
+    }
+  }
+}
+
+// Frames "begin" to "end" of a loop decimated by "factor", filtered around
+// the loop instead of along the sample, so the seam is filtered as the loop
+// plays it.  Frame j is the filtered loop at loopStart + factor * j of "in";
+// frames outside the first period carry on around the loop.
+static void decimateLoop(const float *in, uint64_t loopStart, uint64_t loopLength, int factor, int64_t begin,
+                         int64_t end, float *out)
+{
+  const int center = halfBandTaps / 2;
+  float coefficients[halfBandTaps];
+  makeHalfBandCoefficients(coefficients);
+
+  // Each halving needs the frames either side of the ones it makes, out to
+  // the filter's reach, so work out the span of every stage from the last.
+  int numHalvings = 0;
+  for (int f = factor; f > 1; f /= 2)
+  {
+    numHalvings += 1;
+  }
+  std::vector<int64_t> firsts(numHalvings + 1), lasts(numHalvings + 1);
+  firsts[numHalvings] = begin;
+  lasts[numHalvings] = end;
+  for (int k = numHalvings; k > 0; --k)
+  {
+    firsts[k - 1] = 2 * firsts[k] - center;
+    lasts[k - 1] = 2 * (lasts[k] - 1) + center + 1;
+  }
+
+  const int64_t length = static_cast<int64_t>(loopLength);
+  std::vector<float> stage(lasts[0] - firsts[0]), next;
+  for (int64_t m = firsts[0]; m < lasts[0]; ++m)
+  {
+    int64_t offset = m % length;
+    stage[m - firsts[0]] = in[loopStart + ((offset < 0) ? offset + length : offset)];
+  }
+  for (int k = 1; k <= numHalvings; ++k)
+  {
+    next.assign(lasts[k] - firsts[k], 0.0f);
+    for (int64_t j = firsts[k]; j < lasts[k]; ++j)
+    {
+      const float *x = &stage[2 * j - center - firsts[k - 1]];
+      float acc = 0.0f;
+      for (int i = 0; i < halfBandTaps; ++i)
+      {
+        acc += x[i] * coefficients[i];
+      }
+      next[j - firsts[k]] = acc;
+    }
+    stage.swap(next);
+  }
+  std::copy(stage.begin(), stage.end(), out);
+}
+
 bool Sample::load(SampleLoader &loader)
 {
     SampleBuffer buffer;
@@ -24,6 +144,200 @@ bool Sample::load(SampleLoader &loader)
 
 Sample::~Sample() { }
 
+void Sample::prepareLoop(uint64_t loopStart, uint64_t loopEnd, uint64_t crossfadeFrames)
+{
+  if ((loopStart >= loopEnd) || (loopEnd >= buffer_.sampleLength))
+  {
+    return;
+  }
+
+  uint64_t loopLength = loopEnd + 1 - loopStart;
+  if ((crossfadeFrames > loopStart) || (crossfadeFrames > loopLength))
+  {
+    return;
+  }
+  uint64_t numPeriods = (loopLength > unrolledLoopMaxLength) ? 1 : (unrolledLoopMinLength + loopLength - 1) / loopLength;
+
+  // The decimated copies were filtered along the sample, which smears what
+  // follows the loop into its end.  Their voices play the loop from copies
+  // filtered around it instead, whatever its length.
+  for (int factor = 2; (factor <= maxMipFactor) && (crossfadeFrames == 0); factor *= 2)
+  {
+    if ((getMipLevel(factor) == nullptr) || getLoopBuffer(loopStart, loopEnd, 0, factor))
+    {
+      continue;
+    }
+    LoopBuffer loop;
+    loop.loopStart = loopStart;
+    loop.loopEnd = loopEnd;
+    loop.crossfadeFrames = 0;
+    loop.mipFactor = factor;
+    // By then the filter only reaches into the loop, where the first pass
+    // through the decimated copy agrees with this.
+    loop.entryFrames = std::max<uint64_t>(LoopBuffer::guardFrames, (halfBandTaps / 2) * (factor - 1) / factor + 1);
+    loop.numPeriods = numPeriods;
+    loop.numFrames = (numPeriods * loopLength + factor - 1) / factor + 2 * LoopBuffer::guardFrames;
+    loop.numChannels = buffer_.numChannels;
+    loop.samples.reset(new float[loop.numFrames * loop.numChannels]);
+    for (unsigned int channel = 0; channel < loop.numChannels; ++channel)
+    {
+      decimateLoop(buffer_.getReadPointer(channel), loopStart, loopLength, factor, -LoopBuffer::guardFrames,
+                   static_cast<int64_t>(loop.numFrames) - LoopBuffer::guardFrames,
+                   &loop.samples[channel * loop.numFrames]);
+    }
+    loopBuffers_.push_back(loop);
+  }
+
+  if (getLoopBuffer(loopStart, loopEnd, crossfadeFrames) ||
+      ((loopLength > unrolledLoopMaxLength) && (crossfadeFrames == 0)))
+  {
+    return;
+  }
+
+  LoopBuffer loop;
+  loop.loopStart = loopStart;
+  loop.loopEnd = loopEnd;
+  loop.crossfadeFrames = crossfadeFrames;
+  loop.numPeriods = numPeriods;
+  loop.numFrames = loop.numPeriods * loopLength + 2 * LoopBuffer::guardFrames;
+  loop.numChannels = buffer_.numChannels;
+  loop.samples.reset(new float[loop.numFrames * loop.numChannels]);
+
+  std::vector<float> body(loopLength);
+  for (unsigned int channel = 0; channel < loop.numChannels; ++channel)
+  {
+    const float *in = buffer_.getReadPointer(channel) + loopStart;
+    const float *beforeLoop = in - crossfadeFrames;
+    std::copy(in, in + loopLength, body.begin());
+    // Fade the end of the loop out and what comes before its start in, with
+    // equal power, so the last frame leads into the first.
+    for (uint64_t i = 0; i < crossfadeFrames; ++i)
+    {
+      double fade = (i + 1) * halfPi / crossfadeFrames;
+      float &frame = body[loopLength - crossfadeFrames + i];
+      frame = static_cast<float>(frame * std::cos(fade) + beforeLoop[i] * std::sin(fade));
+    }
+
+    float *out = &loop.samples[channel * loop.numFrames];
+    // Frame i of the unrolled buffer is loop frame (i - guardFrames), wrapped.
+    uint64_t inIndex = (loopLength - LoopBuffer::guardFrames % loopLength) % loopLength;
+    for (uint64_t i = 0; i < loop.numFrames; ++i)
+    {
+      out[i] = body[inIndex];
+      if (++inIndex == loopLength)
+      {
+        inIndex = 0;
+      }
+    }
+  }
+
+  loopBuffers_.push_back(loop);
+}
+
+void Sample::prepareMipLevels()
+{
+  if (!mipLevels_.empty() || (buffer_.sampleLength == 0))
+  {
+    return;
+  }
+
+  const SampleBuffer *previous = &buffer_;
+  for (int factor = 2; factor <= maxMipFactor; factor *= 2)
+  {
+    SampleBuffer level;
+    decimateByTwo(*previous, level);
+    mipLevels_.push_back(level);
+    previous = &mipLevels_.back();
+  }
+}
+
+const SampleBuffer *Sample::getMipLevel(int factor) const
+{
+  size_t index = 0;
+  for (int levelFactor = 2; levelFactor < factor; levelFactor *= 2)
+  {
+    index += 1;
+  }
+  return (index < mipLevels_.size()) ? &mipLevels_[index] : nullptr;
+}
+
+void Sample::prepareResampled(double sampleRate)
+{
+  if ((buffer_.sampleLength == 0) || (buffer_.sampleRate == sampleRate) || getResampled(sampleRate))
+  {
+    return;
+  }
+
+  // When going down in rate, lower the cutoff to the new Nyquist.
+  double step = buffer_.sampleRate / sampleRate;
+  SincTable table(resamplingTaps, 0.95 * std::min(1.0, 1.0 / step));
+  const int tapsBefore = resamplingTaps / 2 - 1;
+
+  SampleBuffer out;
+  out.sampleRate = sampleRate;
+  out.sampleLength = static_cast<uint64_t>(std::ceil(buffer_.sampleLength / step));
+  out.loopStart = static_cast<uint64_t>(buffer_.loopStart / step);
+  out.loopEnd = static_cast<uint64_t>(buffer_.loopEnd / step);
+  out.numChannels = buffer_.numChannels;
+  out.samples.reset(new float[out.sampleLength * out.numChannels]);
+
+  const int64_t inLength = static_cast<int64_t>(buffer_.sampleLength);
+  for (unsigned int channel = 0; channel < buffer_.numChannels; ++channel)
+  {
+    const float *x = buffer_.getReadPointer(channel);
+    float *y = &out.samples[channel * out.sampleLength];
+    for (uint64_t n = 0; n < out.sampleLength; ++n)
+    {
+      double position = n * step;
+      int64_t pos = static_cast<int64_t>(position);
+      double phase = (position - pos) * SincTable::numPhases;
+      int row = std::min(static_cast<int>(phase), SincTable::numPhases - 1);
+      float blend = static_cast<float>(phase - row);
+      const float *c0 = table.getRow(row);
+      const float *c1 = c0 + resamplingTaps;
+      float acc = 0.0f;
+      for (int k = 0; k < resamplingTaps; ++k)
+      {
+        int64_t i = pos - tapsBefore + k;
+        if ((i >= 0) && (i < inLength))
+        {
+          acc += x[i] * (c0[k] + (c1[k] - c0[k]) * blend);
+        }
+      }
+      y[n] = acc;
+    }
+  }
+
+  resampled_.push_back(out);
+}
+
+const SampleBuffer *Sample::getResampled(double sampleRate) const
+{
+  for (size_t i = 0, n = resampled_.size(); i < n; ++i)
+  {
+    if (resampled_[i].sampleRate == sampleRate)
+    {
+      return &resampled_[i];
+    }
+  }
+  return nullptr;
+}
+
+const LoopBuffer *Sample::getLoopBuffer(uint64_t loopStart, uint64_t loopEnd, uint64_t crossfadeFrames,
+                                         int mipFactor) const
+{
+  for (size_t i = 0, n = loopBuffers_.size(); i < n; ++i)
+  {
+    const LoopBuffer &loop = loopBuffers_[i];
+    if ((loop.loopStart == loopStart) && (loop.loopEnd == loopEnd) && (loop.crossfadeFrames == crossfadeFrames) &&
+        (loop.mipFactor == mipFactor))
+    {
+      return &loop;
+    }
+  }
+  return nullptr;
+}
+
 std::string Sample::getShortName() { return getFileName(file_); }
 
 std::string Sample::dump() { return file_ + "\n"; }
@@ -11,8 +11,10 @@
 
 #include "CarlaJuceUtils.hpp"
 
+#include <deque>
 #include <string>
 #include <memory>
+#include <vector>
 
 namespace sfzero
 {
@@ -28,11 +30,49 @@ struct SampleBuffer
 
     SampleBuffer() : sampleRate(0), sampleLength(0), loopStart(0), loopEnd(0), numChannels(0) {}
     float *getReadPointer(unsigned int channel) { return &samples[channel * sampleLength]; }
+    const float *getReadPointer(unsigned int channel) const { return &samples[channel * sampleLength]; }
+};
+
+// A short loop body repeated "numPeriods" times, so that voices playing it
+// don't hit the loop seam every few frames.  getReadPointer() points at the
+// first frame of the loop; "guardFrames" frames before and after the unrolled
+// body hold the end and start of the loop, for the interpolation taps.  With
+// a crossfade, the body's last "crossfadeFrames" frames are faded into the
+// ones leading up to loopStart, so the seam doesn't click; those loops get a
+// buffer even when they're too long to unroll.  A loop for a decimated copy
+// of the sample ("mipFactor" above 1) is decimated the same way, filtered
+// around the loop, and its frames are those of the copy; every such loop gets
+// one.  loopStart and loopEnd are always in frames of the sample.
+struct LoopBuffer
+{
+    // Enough for the widest interpolator (see maxInterpolationTaps).
+    static const int guardFrames = 8;
+
+    uint64_t loopStart, loopEnd, crossfadeFrames;
+    int mipFactor;
+    // How far into the loop a voice has to be on its first pass before it
+    // plays from here.
+    uint64_t entryFrames;
+    uint64_t numPeriods;
+    uint64_t numFrames;
+    unsigned int numChannels;
+    std::shared_ptr<float[]> samples;
+
+    LoopBuffer()
+        : loopStart(0), loopEnd(0), crossfadeFrames(0), mipFactor(1), entryFrames(guardFrames), numPeriods(0),
+          numFrames(0), numChannels(0)
+    {
+    }
+    uint64_t loopLength() const { return loopEnd + 1 - loopStart; }
+    const float *getReadPointer(unsigned int channel) const { return &samples[channel * numFrames + guardFrames]; }
 };
 
 class Sample
 {
 public:
+  // Decimated copies go down to 1/maxMipFactor of the sample rate.
+  static const int maxMipFactor = 4;
+
   Sample(const std::string &fileIn, const std::string &defaultPath) : file_(fileIn), defaultPath_(defaultPath) {}
   virtual ~Sample();
 
@@ -47,6 +87,28 @@ public:
   uint64_t getLoopStart() const { return buffer_.loopStart; }
   uint64_t getLoopEnd() const { return buffer_.loopEnd; }
 
+  // Unrolls the loop if it's short enough to be worth it, and bakes in its
+  // crossfade if it has one.  loopEnd is inclusive, and "crossfadeFrames"
+  // can't be more than loopStart or the loop's length.  Each loop and
+  // crossfade gets its own buffer, leaving the sample as it was.  A loop
+  // without a crossfade also gets one for each decimated copy made by then.
+  void prepareLoop(uint64_t loopStart, uint64_t loopEnd, uint64_t crossfadeFrames = 0);
+  const LoopBuffer *getLoopBuffer(uint64_t loopStart, uint64_t loopEnd, uint64_t crossfadeFrames = 0,
+                                  int mipFactor = 1) const;
+
+  // Builds band-limited copies decimated by 2, 4, ... maxMipFactor, for
+  // playing far above the keycenter.  Call it before prepareLoop(), which
+  // gives them their loops.  Crossfaded loops have none, so regions with a
+  // loop crossfade don't play them.
+  void prepareMipLevels();
+  const SampleBuffer *getMipLevel(int factor) const;
+
+  // Builds a copy resampled to "sampleRate", for regions that always play at
+  // the same pitch.  Copies for other rates are kept, so one a voice is
+  // playing is never replaced.
+  void prepareResampled(double sampleRate);
+  const SampleBuffer *getResampled(double sampleRate) const;
+
 #ifdef DEBUG
   void checkIfZeroed(const char *where);
 #endif
@@ -55,6 +117,10 @@ private:
   std::string file_;
   std::string defaultPath_;
   SampleBuffer buffer_;
+  // A deque, so adding a loop doesn't move the ones voices are playing.
+  std::deque<LoopBuffer> loopBuffers_;
+  std::vector<SampleBuffer> mipLevels_;
+  std::deque<SampleBuffer> resampled_;
 
   CARLA_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Sample)
 };
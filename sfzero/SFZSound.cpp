@@ -16,7 +16,12 @@
 namespace sfzero
 {
 
-Sound::Sound(const std::string &fileIn) : file_(fileIn) {}
+Sound::Sound(const std::string &fileIn)
+    : file_(fileIn), regionIndexBuilt_(false), mipMapping_(false), preResampling_(false),
+      preparedRate_(0.0), frozen_(false)
+{
+  std::fill(keyswitchViews_, keyswitchViews_ + 128, -1);
+}
 Sound::~Sound()
 {
   int numRegions = regions_.size();
@@ -35,9 +40,29 @@ bool Sound::appliesToNote(int /*midiNoteNumber*/)
 }
 
 bool Sound::appliesToChannel(int /*midiChannel*/) { return true; }
-void Sound::addRegion(Region *region) { regions_.push_back(region); }
+void Sound::addRegion(Region *region)
+{
+  jassert(!frozen_);
+  if (frozen_)
+  {
+    delete region;
+    return;
+  }
+  region->index = static_cast<int>(regions_.size());
+  auto groupIndex = groupIndices_.emplace(region->group, static_cast<int>(groupIndices_.size()));
+  region->group_index = groupIndex.first->second;
+  regions_.push_back(region);
+  regionIndexBuilt_ = false;
+  preparedRate_ = 0.0;
+}
+
 Sample *Sound::addSample(const std::string &path, const std::string &defaultPath)
 {
+  jassert(!frozen_);
+  if (frozen_)
+  {
+    return nullptr;
+  }
   Sample *sample = new Sample(path, defaultPath);
   samples_.emplace_back(sample);
   return sample;
@@ -56,13 +81,304 @@ void Sound::addUnsupportedOpcode(const std::string &opcode)
 
 void Sound::loadRegions()
 {
+  jassert(!frozen_);
+  if (frozen_)
+  {
+    return;
+  }
   Reader reader(this);
 
   reader.read(file_);
+  buildGainTables();
+  buildCCConditions();
+  buildRegionIndex();
+}
+
+void Sound::buildGainTables()
+{
+  jassert(!frozen_);
+  if (frozen_)
+  {
+    return;
+  }
+  float gains[128];
+  auto share = [this, &gains]() -> const float * {
+    std::string key(reinterpret_cast<const char *>(gains), sizeof(gains));
+    std::unique_ptr<float[]> &table = gainTables_[key];
+    if (!table)
+    {
+      table.reset(new float[128]);
+      std::copy(gains, gains + 128, table.get());
+    }
+    return table.get();
+  };
+
+  int numRegions = regions_.size();
+  for (int i = 0; i < numRegions; ++i)
+  {
+    Region *region = regions_[i];
+    for (int velocity = 0; velocity < 128; ++velocity)
+    {
+      gains[velocity] = region->computeVelocityGain(velocity);
+    }
+    region->velocity_gains = share();
+    for (int note = 0; note < 128; ++note)
+    {
+      gains[note] = region->computeKeyGain(note);
+    }
+    region->key_gains = share();
+    region->volume_gain = region->computeVolumeGain();
+    for (int j = 0; j < region->num_cc_modulations; ++j)
+    {
+      CCModulation &modulation = region->cc_modulations[j];
+      if (modulation.target == CCModulation::volume)
+      {
+        for (int value = 0; value < 128; ++value)
+        {
+          gains[value] = decibelsToGain(modulation.amount * value / 127.0f);
+        }
+        modulation.gains = share();
+      }
+    }
+  }
+}
+
+void Sound::buildCCConditions()
+{
+  jassert(!frozen_);
+  if (frozen_)
+  {
+    return;
+  }
+  ccConditions_.clear();
+
+  bool tooMany = false;
+  int numRegions = regions_.size();
+  for (int i = 0; i < numRegions; ++i)
+  {
+    Region *region = regions_[i];
+    region->cc_conditions = 0;
+    for (int cc = 0; cc < 128; ++cc)
+    {
+      uint8_t lo = region->locc[cc], hi = region->hicc[cc];
+      if ((lo == 0) && (hi == 127))
+      {
+        continue;
+      }
+      size_t bit = 0;
+      while ((bit < ccConditions_.size()) &&
+             ((ccConditions_[bit].cc != cc) || (ccConditions_[bit].lo != lo) || (ccConditions_[bit].hi != hi)))
+      {
+        ++bit;
+      }
+      if (bit == ccConditions_.size())
+      {
+        if (bit == 64)
+        {
+          tooMany = true;
+          continue;
+        }
+        CCCondition condition = {cc, lo, hi};
+        ccConditions_.push_back(condition);
+      }
+      region->cc_conditions |= uint64_t(1) << bit;
+    }
+  }
+  if (tooMany)
+  {
+    warnings_.push_back("more than 64 different locc/hicc ranges; the rest are ignored");
+  }
+}
+
+uint64_t Sound::getCCConditionsMet(const uint8_t *controllers) const
+{
+  uint64_t met = 0;
+  int numConditions = ccConditions_.size();
+  for (int bit = 0; bit < numConditions; ++bit)
+  {
+    const CCCondition &condition = ccConditions_[bit];
+    int value = controllers[condition.cc];
+    if ((value >= condition.lo) && (value <= condition.hi))
+    {
+      met |= uint64_t(1) << bit;
+    }
+  }
+  return met;
+}
+
+// Whether two regions on the same note are only told apart by the round
+// robin and the random number.
+static bool inSameLayer(const Region *region, const Region *other)
+{
+  return (region->lovel == other->lovel) && (region->hivel == other->hivel) && (region->trigger == other->trigger) &&
+         (region->cc_conditions == other->cc_conditions) && (region->seq_length == other->seq_length) &&
+         (region->sw_last == other->sw_last) && (region->sw_default == other->sw_default) &&
+         (region->sw_down == other->sw_down) && (region->sw_up == other->sw_up);
+}
+
+void Sound::buildRegionIndex()
+{
+  jassert(!frozen_);
+  if (frozen_)
+  {
+    return;
+  }
+  layerRegions_.clear();
+  layerSeqStarts_.clear();
+
+  // Number the articulations: the keys each one is picked by, standing in
+  // for "before any keyswitch" with -1 and "none of the articulations" with
+  // a key no region switches to.
+  std::fill(keyswitchViews_, keyswitchViews_ + 128, -1);
+  std::vector<int> viewKeys;
+  viewKeys.push_back(-1);
+  viewKeys.push_back(128);
+  for (const Region *region : regions_)
+  {
+    if ((region->sw_lokey >= 0) && (region->sw_hikey >= 0))
+    {
+      for (int key = region->sw_lokey; key <= region->sw_hikey; ++key)
+      {
+        keyswitchViews_[key] = std::max(keyswitchViews_[key], 1);
+      }
+    }
+  }
+  for (const Region *region : regions_)
+  {
+    if ((region->sw_last >= 0) && (keyswitchViews_[region->sw_last] < 2))
+    {
+      keyswitchViews_[region->sw_last] = static_cast<int>(viewKeys.size());
+      viewKeys.push_back(region->sw_last);
+    }
+  }
+  int numViews = viewKeys.size();
+  viewLayers_.assign(numViews * 128, std::vector<NoteLayer>());
+
+  std::vector<Region *> candidates, members;
+  std::vector<bool> placed;
+  for (int note = 0; note < 128; ++note)
+  {
+    candidates.clear();
+    for (Region *region : regions_)
+    {
+      if ((note >= region->lokey) && (note <= region->hikey))
+      {
+        candidates.push_back(region);
+      }
+    }
+
+    int numCandidates = candidates.size();
+    placed.assign(numCandidates, false);
+    for (int i = 0; i < numCandidates; ++i)
+    {
+      if (placed[i])
+      {
+        continue;
+      }
+      members.clear();
+      for (int j = i; j < numCandidates; ++j)
+      {
+        if (!placed[j] && inSameLayer(candidates[i], candidates[j]))
+        {
+          members.push_back(candidates[j]);
+          placed[j] = true;
+        }
+      }
+      std::stable_sort(members.begin(), members.end(), [](const Region *a, const Region *b) {
+        return a->seq_position < b->seq_position;
+      });
+
+      NoteLayer layer;
+      layer.seqLength = std::max(candidates[i]->seq_length, 1);
+      layer.begin = static_cast<int>(layerRegions_.size());
+      layerRegions_.insert(layerRegions_.end(), members.begin(), members.end());
+      layer.end = static_cast<int>(layerRegions_.size());
+      layer.seqStarts = static_cast<int>(layerSeqStarts_.size());
+      if (layer.seqLength > 1)
+      {
+        // Positions outside 1 to seq_length never come up.
+        int member = 0, numMembers = members.size();
+        for (int position = 1; position <= layer.seqLength + 1; ++position)
+        {
+          while ((member < numMembers) && (members[member]->seq_position < position))
+          {
+            member += 1;
+          }
+          layerSeqStarts_.push_back(layer.begin + member);
+        }
+      }
+      for (int view = 0; view < numViews; ++view)
+      {
+        if (candidates[i]->matchesKeyswitch(viewKeys[view]))
+        {
+          viewLayers_[view * 128 + note].push_back(layer);
+        }
+      }
+    }
+  }
+  regionIndexBuilt_ = true;
+}
+
+int Sound::selectRegions(int note, const NoteContext &context, const Region **regions, int maxRegions) const
+{
+  int count = 0;
+  if (!regionIndexBuilt_)
+  {
+    for (const Region *region : regions_)
+    {
+      if ((count < maxRegions) && region->matches(note, context.velocity, context.trigger) &&
+          ((region->cc_conditions & ~context.ccConditionsMet) == 0) && region->matchesSequence(context.sequence) &&
+          region->matchesRandom(context.random) && region->matchesKeyswitch(context.keyswitch) &&
+          (!context.keysDown || region->matchesKeysDown(*context.keysDown)))
+      {
+        regions[count++] = region;
+      }
+    }
+    return count;
+  }
+
+  // A keyswitch this sound doesn't know, say from before a sound swap, counts
+  // as none.
+  int view = 0;
+  if ((context.keyswitch >= 0) && (keyswitchViews_[context.keyswitch & 0x7F] >= 0))
+  {
+    view = keyswitchViews_[context.keyswitch & 0x7F];
+  }
+  for (const NoteLayer &layer : viewLayers_[view * 128 + (note & 0x7F)])
+  {
+    // Everything but the round robin and the random number is the same for
+    // all the layer's regions.
+    Region *first = layerRegions_[layer.begin];
+    if (!first->matches(note, context.velocity, context.trigger) ||
+        ((first->cc_conditions & ~context.ccConditionsMet) != 0) ||
+        (context.keysDown && !first->matchesKeysDown(*context.keysDown)))
+    {
+      continue;
+    }
+    int begin = layer.begin, end = layer.end;
+    if (layer.seqLength > 1)
+    {
+      int position = context.sequence % static_cast<unsigned int>(layer.seqLength);
+      begin = layerSeqStarts_[layer.seqStarts + position];
+      end = layerSeqStarts_[layer.seqStarts + position + 1];
+    }
+    for (int i = begin; (i < end) && (count < maxRegions); ++i)
+    {
+      if (layerRegions_[i]->matchesRandom(context.random))
+      {
+        regions[count++] = layerRegions_[i];
+      }
+    }
+  }
+  return count;
 }
 
 void Sound::loadSamples(SampleLoader &loader, const LoadingIdleCallback& cb)
 {
+    jassert(!frozen_);
+    if (frozen_)
+        return;
+
     int numSamples = samples_.size();
 
     for (int i = 0; i < numSamples; ++i)
@@ -71,6 +387,9 @@ void Sound::loadSamples(SampleLoader &loader, const LoadingIdleCallback& cb)
 
         if (sample->load(loader))
         {
+            if (mipMapping_)
+                sample->prepareMipLevels();
+
             carla_debug("Loaded sample '%s'", sample->getShortName().toRawUTF8());
             if (cb.callback)
                 cb.callback(cb.callbackPtr);
@@ -80,15 +399,73 @@ void Sound::loadSamples(SampleLoader &loader, const LoadingIdleCallback& cb)
             addError("Couldn't load sample \"" + sample->getShortName() + "\"");
         }
     }
+
+    // Unroll the short loops the regions play, and bake in their crossfades.
+    int numRegions = regions_.size();
+
+    for (int i = 0; i < numRegions; ++i)
+    {
+        Region* const region = regions_[i];
+        int64_t loopStart, loopEnd;
+
+        if (region->getLoopPoints(loopStart, loopEnd))
+            region->sample->prepareLoop(loopStart, loopEnd, region->getLoopCrossfadeFrames(loopStart, loopEnd));
+    }
+
+    // Any pre-resampling was done without the samples.
+    preparedRate_ = 0.0;
+}
+
+void Sound::prepareForSampleRate(double sampleRate)
+{
+    jassert(!frozen_ || (preparedRate_ == sampleRate));
+    if (frozen_ || (preparedRate_ == sampleRate))
+        return;
+
+    if (!regionIndexBuilt_)
+    {
+        buildCCConditions();
+        buildRegionIndex();
+    }
+
+    int numRegions = regions_.size();
+
+    for (int i = 0; i < numRegions; ++i)
+    {
+        Region* const region = regions_[i];
+        int64_t loopStart, loopEnd;
+
+        region->prepare(sampleRate);
+
+        if (preResampling_ && region->sample && region->pitch_keytrack == 0 && !region->getLoopPoints(loopStart, loopEnd))
+            region->sample->prepareResampled(sampleRate);
+    }
+
+    preparedRate_ = sampleRate;
+}
+
+void Sound::freeze(double sampleRate)
+{
+    if (frozen_)
+        return;
+
+    prepareForSampleRate(sampleRate);
+    frozen_ = true;
 }
 
 Region *Sound::getRegionFor(int note, int velocity, Region::Trigger trigger)
+{
+  jassert(!frozen_);
+  return const_cast<Region *>(static_cast<const Sound *>(this)->getRegionFor(note, velocity, trigger));
+}
+
+const Region *Sound::getRegionFor(int note, int velocity, Region::Trigger trigger) const
 {
   int numRegions = regions_.size();
 
   for (int i = 0; i < numRegions; ++i)
   {
-    Region *region = regions_[i];
+    const Region *region = regions_[i];
     if (region->matches(note, velocity, trigger))
     {
       return region;
@@ -100,7 +477,13 @@ Region *Sound::getRegionFor(int note, int velocity, Region::Trigger trigger)
 
 int Sound::getNumRegions() { return regions_.size(); }
 
-Region *Sound::regionAt(int index) { return regions_[index]; }
+Region *Sound::regionAt(int index)
+{
+  jassert(!frozen_);
+  return regions_[index];
+}
+
+const Region *Sound::regionAt(int index) const { return regions_[index]; }
 
 std::string Sound::dump()
 {
@@ -11,6 +11,7 @@
 
 #include "water/synthesisers/Synthesiser.h"
 
+#include <bitset>
 #include <vector>
 #include <string>
 #include <unordered_map>
@@ -22,6 +23,23 @@ namespace sfzero
 class Sample;
 class SampleLoader;
 
+// What decides which regions play a note, apart from its key.
+struct NoteContext
+{
+  int velocity;
+  Region::Trigger trigger;
+  // The bits of Region::cc_conditions that the channel's controllers meet.
+  uint64_t ccConditionsMet;
+  // How many notes have been played on the key before, for round robins, and
+  // a number from 0 to 1 for lorand/hirand.
+  unsigned int sequence;
+  float random;
+  // The last keyswitch pressed, or -1 if none has been, and the keys held
+  // down, for sw_down and sw_up (null to leave those out).
+  int keyswitch;
+  const std::bitset<128> *keysDown;
+};
+
 class Sound : public water::SynthesiserSound
 {
 public:
@@ -43,12 +61,92 @@ public:
   void addError(const std::string &message);
   void addUnsupportedOpcode(const std::string &opcode);
 
+  // Whether loadSamples() also builds decimated copies of the samples, for
+  // cleaner and cheaper playback far above the keycenter.  Off by default,
+  // since the 2x and 4x copies take 75% more memory, and the regions' loops
+  // get decimated copies of their own.
+  void setMipMapping(bool enabled)
+  {
+    jassert(!frozen_);
+    if (frozen_)
+    {
+      return;
+    }
+    mipMapping_ = enabled;
+  }
+
+  // Whether prepareForSampleRate() resamples the samples of regions that
+  // always play at the same pitch (pitch_keytrack=0, no loop) to the output
+  // rate, so their voices can skip interpolating.  Off by default.
+  void setPreResampling(bool enabled)
+  {
+    jassert(!frozen_);
+    if (frozen_)
+    {
+      return;
+    }
+    preResampling_ = enabled;
+    preparedRate_ = 0.0;
+  }
+
+  // Prepares for playback at "sampleRate", after loadSamples(): works out
+  // each region's EG coefficients and gains, and does any pre-resampling.
+  // This can be slow, so call it off the audio thread, while the sound isn't
+  // playing.  Synth calls it when its playback rate is set, after stopping
+  // its voices.  Does nothing if the sound is already prepared for the rate.
+  // A frozen sound can't be prepared again; Synth leaves those alone.
+  virtual void prepareForSampleRate(double sampleRate);
+  bool isPreparedFor(double sampleRate) const { return preparedRate_ == sampleRate; }
+
+  // Bakes each region's velocity and key gains, and the gains of its
+  // volume_onccN modulations by controller value, into tables, sharing the
+  // tables between regions that work out the same.  loadRegions() does this;
+  // call it after adding regions some other way.
+  void buildGainTables();
+
+  // Numbers the different locc_N/hicc_N ranges the regions ask for, and sets
+  // each region's cc_conditions to the bits of its ranges, so a synth can
+  // tell which regions its controllers allow with one test per region.  Up to
+  // 64 ranges are tracked; regions ignore any beyond those.  loadRegions()
+  // does this; call it after adding regions some other way.
+  void buildCCConditions();
+  // The bits of the ranges that hold for the controller values in
+  // "controllers".
+  uint64_t getCCConditionsMet(const uint8_t *controllers) const;
+
+  // Indexes the regions by note, grouping the ones that only differ in
+  // seq_position, lorand and hirand, so selectRegions() goes straight to the
+  // ones whose turn it is instead of trying each.  loadRegions() does this
+  // after buildCCConditions(), and prepareForSampleRate() does both if
+  // regions have been added since.
+  void buildRegionIndex();
+  // Puts the regions that play "note" in "context" into "regions", up to
+  // "maxRegions" of them, and returns how many there are.
+  int selectRegions(int note, const NoteContext &context, const Region **regions, int maxRegions) const;
+  // Whether "note" is a keyswitch, picking an articulation.  Only known once
+  // the regions are indexed.
+  bool isKeyswitch(int note) const { return keyswitchViews_[note & 0x7F] >= 0; }
+
   virtual void loadRegions();
   virtual void loadSamples(SampleLoader &loader, const LoadingIdleCallback& cb);
 
+  // Prepares the sound for "sampleRate" and makes it read-only, so that any
+  // number of synths can play it at once from their own threads; all the
+  // playing state is in the voices.  Call it after loadSamples().  From then
+  // on, adding, loading, preparing and the accessors that hand out regions to
+  // change assert in debug builds and do nothing otherwise; synths read the
+  // regions through the const ones.  Synths running at another rate work out
+  // the rate-dependent values per note instead.
+  void freeze(double sampleRate);
+  bool isFrozen() const { return frozen_; }
+
   Region *getRegionFor(int note, int velocity, Region::Trigger trigger = Region::attack);
+  const Region *getRegionFor(int note, int velocity, Region::Trigger trigger = Region::attack) const;
   int getNumRegions();
   Region *regionAt(int index);
+  const Region *regionAt(int index) const;
+  // The number of different group numbers the regions use.
+  int getNumGroups() const { return static_cast<int>(groupIndices_.size()); }
 
   const std::vector<std::string> &getErrors() { return errors_; }
   const std::vector<std::string> &getWarnings() { return warnings_; }
@@ -56,7 +154,13 @@ public:
   std::string dump();
   void dumpToConsole();
 
-  std::vector<Region *> &getRegions() { return regions_; }
+  // Not for a frozen sound.
+  std::vector<Region *> &getRegions()
+  {
+    jassert(!frozen_);
+    return regions_;
+  }
+  const std::vector<Region *> &getRegions() const { return regions_; }
   const std::string &getFile() { return file_; }
 
 private:
@@ -66,6 +170,41 @@ private:
   std::vector<std::string> errors_;
   std::vector<std::string> warnings_;
   std::unordered_set<std::string> unsupportedOpcodes_;
+  std::unordered_map<int, int> groupIndices_;
+  // The controller ranges numbered by buildCCConditions().
+  struct CCCondition
+  {
+    int cc;
+    uint8_t lo, hi;
+  };
+  std::vector<CCCondition> ccConditions_;
+  // Each note's layers: sets of regions that only differ in seq_position,
+  // lorand and hirand.  A layer's regions are in layerRegions_ from "begin"
+  // to "end", by seq_position.  In a round robin, layerSeqStarts_ from
+  // "seqStarts" has where each position's regions start, then the end.
+  // There's a set of layer lists, one list per note, for each articulation
+  // the keyswitches can pick, so a note only sees the current one's layers.
+  struct NoteLayer
+  {
+    int seqLength;
+    int begin, end;
+    int seqStarts;
+  };
+  std::vector<std::vector<NoteLayer>> viewLayers_;
+  // The articulation each keyswitch picks, as an index into viewLayers_ (in
+  // units of 128 notes), or -1 for keys that aren't keyswitches.  The first
+  // set is for before any keyswitch is pressed, and the second for
+  // keyswitches with no articulation of their own.
+  int keyswitchViews_[128];
+  std::vector<Region *> layerRegions_;
+  std::vector<int> layerSeqStarts_;
+  bool regionIndexBuilt_;
+  // The gain tables, by their contents.
+  std::unordered_map<std::string, std::unique_ptr<float[]>> gainTables_;
+  bool mipMapping_;
+  bool preResampling_;
+  double preparedRate_;
+  bool frozen_;
 
   CARLA_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Sound)
 };
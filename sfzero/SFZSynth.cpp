@@ -9,125 +9,1442 @@
 #include "SFZSound.h"
 #include "SFZVoice.h"
 
+#include <algorithm>
 #include <sstream>
 
 namespace sfzero
 {
 
-Synth::Synth() : Synthesiser()
+static int channelIndex(int midiChannel) { return std::max(0, std::min(midiChannel - 1, 15)); }
+static bool isNoteOnEvent(const MidiEvent &event)
 {
-    carla_zeroStructs(noteVelocities_, 128);
+  return ((event.status & 0xF0) == 0x90) && ((event.data2 & 0x7F) > 0);
+}
+
+static const float defaultCullLevelDB = -90.0f;
+static const int defaultMidiQueueSize = 1024;
+// A managed voice pool frees idle voices once it has been mostly idle for
+// this long.
+static const double poolShrinkDelaySeconds = 2.0;
+static const uint32_t defaultRandomSeed = 0x2545F491;
+
+Synth::Synth()
+    : Synthesiser(), quality_(interpolateLinear), cullLevelDB_(defaultCullLevelDB),
+      cullLevel_(decibelsToGain(defaultCullLevelDB)), numCulled_(0), numStolen_(0), numActiveVoices_(0),
+      minPoolVoices_(0), maxPoolVoices_(0), numPoolVoices_(0), poolSize_(0), peakVoiceUsage_(0), underusedFrames_(0), numSounding_(0),
+      soundsIncoming_(false), renderingEvents_(false), eventLeft_(nullptr), eventRight_(nullptr), eventTime_(0)
+{
+    carla_zeroStructs(noteVelocities_[0], 16 * 128);
+    carla_zeroStructs(keySequences_[0], 16 * 128);
+    carla_zeroStructs(noteSequences_[0], 16 * 128);
+    carla_zeroStructs(noteRandoms_[0], 16 * 128);
+    setRandomSeed(defaultRandomSeed);
+    for (int i = 0; i < 16; ++i)
+    {
+        incomingSounds_[i].store(nullptr);
+        resetControllers(i, false);
+        lastKeyswitch_[i] = -1;
+    }
+    setMidiQueueSize(defaultMidiQueueSize);
+}
+
+Synth::~Synth()
+{
+    voicePool_.stop();
+    for (int i = 0; i < numPoolVoices_; ++i)
+    {
+        delete poolVoices_[i];
+    }
+
+    // Let go of any swapped-in sounds that never got played.
+    for (int i = 0; i < 16; ++i)
+    {
+        IncomingSound *incoming = incomingSounds_[i].exchange(nullptr);
+        if (incoming)
+        {
+            incoming->sound->decReferenceCount();
+        }
+    }
 }
 
 void Synth::noteOn(int midiChannel, int midiNoteNumber, float velocity)
 {
-  int i;
+  // While rendering, the voice table is as of the start of the block.
+  if (!renderingEvents_)
+  {
+    updateVoiceTable();
+  }
+  playNote(midiChannel, midiNoteNumber, velocity);
+}
+
+void Synth::noteOns(const MidiEvent *events, int numEvents)
+{
+  if (!renderingEvents_)
+  {
+    updateVoiceTable();
+  }
+  for (int i = 0; i < numEvents; ++i)
+  {
+    const MidiEvent &event = events[i];
+    if (isNoteOnEvent(event))
+    {
+      playNote((event.status & 0x0F) + 1, event.data1 & 0x7F, (event.data2 & 0x7F) / 127.0f);
+    }
+  }
+}
+
+void Synth::playNote(int midiChannel, int midiNoteNumber, float velocity)
+{
+  int i;
+
+  int midiVelocity = static_cast<int>(velocity * 127);
+  int channel = channelIndex(midiChannel);
+  // Striking the key again ends what the sustain pedal was holding.
+  sustainedNotes_[channel].reset(midiNoteNumber);
+
+  // Are any other notes down?  (Needed for first/legato trigger handling.)
+  notesDown_[channel].reset(midiNoteNumber);
+  bool anyNotesPlaying = notesDown_[channel].any();
+
+  // Play *all* matching regions, or the ones whose turn it is in a round
+  // robin or a random choice, in the articulation the keyswitches picked.
+  Sound *sound = getChannelSound(midiChannel);
+  if (sound && sound->isKeyswitch(midiNoteNumber))
+  {
+    lastKeyswitch_[channel] = midiNoteNumber;
+  }
+  NoteContext context;
+  context.velocity = midiVelocity;
+  context.trigger = (anyNotesPlaying ? Region::legato : Region::first);
+  context.ccConditionsMet = 0;
+  context.sequence = keySequences_[channel][midiNoteNumber]++;
+  context.random = nextRandom();
+  context.keyswitch = lastKeyswitch_[channel];
+  context.keysDown = &notesDown_[channel];
+  int numRegions = 0;
+  if (sound)
+  {
+    // Regions with locc/hicc ranges the controllers are outside of don't
+    // play.
+    context.ccConditionsMet = sound->getCCConditionsMet(controllerValues_[channel]);
+    numRegions = sound->selectRegions(midiNoteNumber, context, noteRegions_, maxRegionsPerNote);
+  }
+
+  // First, stop any currently-playing sounds in the group.
+  //*** Currently, this only pays attention to the first matching region.
+  std::vector<VoiceList> &groupVoices = groupVoices_[channel];
+  if (numRegions > 0)
+  {
+    const Region *region = noteRegions_[0];
+    if ((region->group != 0) && (region->group_index < static_cast<int>(groupVoices.size())))
+    {
+      VoiceList &list = groupVoices[region->group_index];
+      for (Voice *voice = list.getFirst(); voice;)
+      {
+        Voice *next = VoiceList::getNext(voice, VoiceList::byGroup);
+        if ((voice->getGroup() == region->group) && catchUp(voice))
+        {
+          voice->stopNoteForGroup();
+        }
+        voice = next;
+      }
+    }
+    else if (region->group != 0)
+    {
+      int numVoices = static_cast<int>(voiceTable_.size());
+      for (i = 0; i < numVoices; ++i)
+      {
+        Voice *voice = voiceTable_[i];
+        if (voice && belongsWith(voice, region, midiChannel, true) && catchUp(voice))
+        {
+          voice->stopNoteForGroup();
+        }
+      }
+    }
+  }
+
+  // Also stop any voices still playing this note.
+  VoiceList &noteList = noteVoices_[channel][midiNoteNumber];
+  for (Voice *voice = noteList.getFirst(); voice;)
+  {
+    Voice *next = VoiceList::getNext(voice, VoiceList::byNote);
+    if (voice->isPlayingNoteDown() && !voice->isPlayingOneShot() && catchUp(voice))
+    {
+      voice->stopNoteQuick();
+    }
+    voice = next;
+  }
+
+  for (i = 0; i < numRegions; ++i)
+  {
+    const Region *region = noteRegions_[i];
+    limitPolyphony(region, midiChannel, midiNoteNumber);
+    Voice *voice = takeVoice(isNoteStealingEnabled());
+    if (voice)
+    {
+      voice->setRegion(region);
+      voice->setInterpolationQuality(quality_);
+      voice->setCullLevel(cullLevel_);
+      voice->setControllers(controllerValues_[channel]);
+      startVoice(voice, sound, midiChannel, midiNoteNumber, velocity);
+      addToVoiceLists(voice, midiChannel, midiNoteNumber);
+    }
+  }
+
+  noteSequences_[channel][midiNoteNumber] = context.sequence;
+  noteRandoms_[channel][midiNoteNumber] = context.random;
+  noteVelocities_[channel][midiNoteNumber] = midiVelocity;
+  notesDown_[channel].set(midiNoteNumber);
+}
+
+void Synth::noteOff(int midiChannel, int midiNoteNumber, float velocity, bool allowTailOff)
+{
+  int channel = channelIndex(midiChannel);
+  notesDown_[channel].reset(midiNoteNumber);
+
+  // The sustain pedal holds the note-off until it comes up.
+  if (sustainDown_[channel])
+  {
+    sustainedNotes_[channel].set(midiNoteNumber);
+    return;
+  }
+
+  // Release the voices playing this note, as Synthesiser::noteOff() would,
+  // but without looking at every voice.
+  VoiceList &noteList = noteVoices_[channel][midiNoteNumber];
+  for (Voice *voice = noteList.getFirst(); voice;)
+  {
+    Voice *next = VoiceList::getNext(voice, VoiceList::byNote);
+    if (voice->isVoiceActive() && catchUp(voice))
+    {
+      voice->setKeyDown(false);
+      if (!(voice->isSustainPedalDown() || voice->isSostenutoPedalDown()))
+      {
+        stopVoice(voice, velocity, allowTailOff);
+      }
+    }
+    retireIfStopped(voice);
+    voice = next;
+  }
+
+  // Start release region.
+  Sound *sound = getChannelSound(midiChannel);
+  int midiVelocity = noteVelocities_[channel][midiNoteNumber];
+  if (sound)
+  {
+    // The release takes its turn in any round robin or random choice along
+    // with the note-on.
+    NoteContext context;
+    context.velocity = midiVelocity;
+    context.trigger = Region::release;
+    context.ccConditionsMet = sound->getCCConditionsMet(controllerValues_[channel]);
+    context.sequence = noteSequences_[channel][midiNoteNumber];
+    context.random = noteRandoms_[channel][midiNoteNumber];
+    context.keyswitch = lastKeyswitch_[channel];
+    context.keysDown = &notesDown_[channel];
+    const Region *region = nullptr;
+    if (sound->selectRegions(midiNoteNumber, context, &region, 1) > 0)
+    {
+      limitPolyphony(region, midiChannel, midiNoteNumber);
+      Voice *voice = takeVoice(false);
+      if (voice)
+      {
+        // Synthesiser is too locked-down (ivars are private rt protected), so
+        // we have to use a "setRegion()" mechanism.
+        voice->setRegion(region);
+        voice->setInterpolationQuality(quality_);
+        voice->setCullLevel(cullLevel_);
+        voice->setControllers(controllerValues_[channel]);
+        startVoice(voice, sound, midiChannel, midiNoteNumber, midiVelocity / 127.0f);
+        addToVoiceLists(voice, midiChannel, midiNoteNumber);
+      }
+    }
+  }
+}
+
+void Synth::setRandomSeed(uint32_t seed)
+{
+  // Xorshift gets stuck at zero.
+  randomState_ = (seed != 0) ? seed : defaultRandomSeed;
+}
+
+float Synth::nextRandom()
+{
+  // Xorshift32: cheap, allocation-free and the same on every platform.
+  randomState_ ^= randomState_ << 13;
+  randomState_ ^= randomState_ >> 17;
+  randomState_ ^= randomState_ << 5;
+  return (randomState_ >> 8) * (1.0f / 16777216.0f);
+}
+
+void Synth::handleController(int midiChannel, int controllerNumber, int controllerValue)
+{
+  int channel = channelIndex(midiChannel);
+  controllerNumber &= 0x7F;
+  controllerValue &= 0x7F;
+
+  switch (controllerNumber)
+  {
+  case 0x40:
+    controllerValues_[channel][controllerNumber] = static_cast<uint8_t>(controllerValue);
+    if (controllerValue >= 64)
+    {
+      sustainDown_[channel] = true;
+    }
+    else
+    {
+      releaseSustainedNotes(channel);
+    }
+    break;
+
+  case 0x42:
+    controllerValues_[channel][controllerNumber] = static_cast<uint8_t>(controllerValue);
+    handleSostenutoPedal(midiChannel, controllerValue >= 64);
+    // That can stop voices without going through us.
+    if (!renderingEvents_)
+    {
+      updateVoiceTable();
+    }
+    collectFreeVoices();
+    break;
+
+  case 0x43:
+    controllerValues_[channel][controllerNumber] = static_cast<uint8_t>(controllerValue);
+    handleSoftPedal(midiChannel, controllerValue >= 64);
+    break;
+
+  case 121:
+    resetControllers(channel, true);
+    break;
+
+  default:
+    controllerValues_[channel][controllerNumber] = static_cast<uint8_t>(controllerValue);
+    break;
+  }
+}
+
+void Synth::resetControllers(int channel, bool keepVolumeAndPan)
+{
+  uint8_t *values = controllerValues_[channel];
+  uint8_t volume = keepVolumeAndPan ? values[7] : 100;
+  uint8_t pan = keepVolumeAndPan ? values[10] : 64;
+  std::fill(values, values + 128, 0);
+  values[7] = volume;
+  values[10] = pan;
+  values[11] = 127;
+  releaseSustainedNotes(channel);
+}
+
+void Synth::releaseSustainedNotes(int channel)
+{
+  sustainDown_[channel] = false;
+  std::bitset<128> &notes = sustainedNotes_[channel];
+  if (notes.none())
+  {
+    return;
+  }
+  for (int note = 0; note < 128; ++note)
+  {
+    if (notes.test(note))
+    {
+      noteOff(channel + 1, note, 0.0f, true);
+    }
+  }
+  notes.reset();
+}
+
+void Synth::allNotesOff(int midiChannel, bool allowTailOff)
+{
+  for (int channel = 0; channel < 16; ++channel)
+  {
+    if ((midiChannel <= 0) || (channel == midiChannel - 1))
+    {
+      sustainedNotes_[channel].reset();
+    }
+  }
+  Synthesiser::allNotesOff(midiChannel, allowTailOff);
+  for (int i = 0; i < numPoolVoices_; ++i)
+  {
+    Voice *voice = poolVoices_[i];
+    if ((midiChannel <= 0) || voice->isPlayingChannel(midiChannel))
+    {
+      voice->stopNote(1.0f, allowTailOff);
+    }
+  }
+  if (!renderingEvents_)
+  {
+    updateVoiceTable();
+  }
+  collectFreeVoices();
+}
+
+void Synth::handlePitchWheel(int midiChannel, int wheelValue)
+{
+  Synthesiser::handlePitchWheel(midiChannel, wheelValue);
+  for (int i = 0; i < numPoolVoices_; ++i)
+  {
+    Voice *voice = poolVoices_[i];
+    if (voice->isPlayingChannel(midiChannel))
+    {
+      voice->pitchWheelMoved(wheelValue);
+    }
+  }
+}
+
+void Synth::handleAftertouch(int midiChannel, int midiNoteNumber, int aftertouchValue)
+{
+  Synthesiser::handleAftertouch(midiChannel, midiNoteNumber, aftertouchValue);
+  for (int i = 0; i < numPoolVoices_; ++i)
+  {
+    Voice *voice = poolVoices_[i];
+    if ((voice->getCurrentlyPlayingNote() == midiNoteNumber) &&
+        ((midiChannel <= 0) || voice->isPlayingChannel(midiChannel)))
+    {
+      voice->aftertouchChanged(aftertouchValue);
+    }
+  }
+}
+
+void Synth::handleChannelPressure(int midiChannel, int channelPressureValue)
+{
+  Synthesiser::handleChannelPressure(midiChannel, channelPressureValue);
+  for (int i = 0; i < numPoolVoices_; ++i)
+  {
+    Voice *voice = poolVoices_[i];
+    if ((midiChannel <= 0) || voice->isPlayingChannel(midiChannel))
+    {
+      voice->channelPressureChanged(channelPressureValue);
+    }
+  }
+}
+
+void Synth::handleSostenutoPedal(int midiChannel, bool isDown)
+{
+  Synthesiser::handleSostenutoPedal(midiChannel, isDown);
+  for (int i = 0; i < numPoolVoices_; ++i)
+  {
+    Voice *voice = poolVoices_[i];
+    if (!voice->isPlayingChannel(midiChannel))
+    {
+      continue;
+    }
+    if (isDown)
+    {
+      voice->setSostenutoPedalDown(true);
+    }
+    else if (voice->isSostenutoPedalDown())
+    {
+      stopVoice(voice, 1.0f, true);
+    }
+  }
+}
+
+void Synth::setChannelSound(int midiChannel, Sound *sound)
+{
+  int channel = channelIndex(midiChannel);
+  publishedSounds_[channel] = sound;
+  if (channelSounds_[channel].get() != sound)
+  {
+    channelSounds_[channel] = sound;
+    forgetChannelVoices(channel);
+  }
+  sizeChannelVoiceLists(channel);
+}
+
+void Synth::swapChannelSound(int midiChannel, Sound *sound)
+{
+  if (sound == nullptr)
+  {
+    return;
+  }
+  int channel = channelIndex(midiChannel);
+  if ((getSampleRate() > 0) && !sound->isFrozen() && !isUsingSound(sound))
+  {
+    sound->prepareForSampleRate(getSampleRate());
+  }
+
+  // The audio thread may still be playing the old sound, so keep it until
+  // it's done with it.
+  Sound *old = publishedSounds_[channel].get();
+  if (old && (std::find(retiredSounds_.begin(), retiredSounds_.end(), old) == retiredSounds_.end()))
+  {
+    retiredSounds_.push_back(old);
+  }
+  publishedSounds_[channel] = sound;
+
+  // The lists are made here so that the audio thread only swaps them in.
+  std::unique_ptr<IncomingSound> incoming(new IncomingSound());
+  incoming->sound = sound;
+  incoming->regionVoices.resize(sound->getNumRegions());
+  incoming->groupVoices.resize(sound->getNumGroups());
+  incomingStore_.push_back(std::move(incoming));
+
+  // The reference taken here passes to the audio thread with the pointer.  A
+  // sound it hasn't picked up yet is replaced, and is retired already.
+  sound->incReferenceCount();
+  IncomingSound *unused = incomingSounds_[channel].exchange(incomingStore_.back().get(), std::memory_order_acq_rel);
+  if (unused)
+  {
+    unused->sound->decReferenceCount();
+    unused->installed.store(true, std::memory_order_relaxed);
+  }
+  soundsIncoming_.store(true, std::memory_order_release);
+
+  releaseRetiredSounds();
+}
+
+void Synth::releaseRetiredSounds()
+{
+  // Once only this list holds a sound, nothing can pick it up again.
+  for (size_t i = retiredSounds_.size(); i-- > 0;)
+  {
+    if (retiredSounds_[i]->getReferenceCount() == 1)
+    {
+      retiredSounds_.erase(retiredSounds_.begin() + i);
+    }
+  }
+  // Installed ones hold the lists the audio thread swapped out.
+  for (size_t i = incomingStore_.size(); i-- > 0;)
+  {
+    if (incomingStore_[i]->installed.load(std::memory_order_acquire))
+    {
+      incomingStore_.erase(incomingStore_.begin() + i);
+    }
+  }
+}
+
+bool Synth::isUsingSound(Sound *sound)
+{
+  if (sounds.contains(sound))
+  {
+    return true;
+  }
+  for (int channel = 0; channel < 16; ++channel)
+  {
+    if (publishedSounds_[channel].get() == sound)
+    {
+      return true;
+    }
+  }
+  return std::find(retiredSounds_.begin(), retiredSounds_.end(), sound) != retiredSounds_.end();
+}
+
+void Synth::installIncomingSounds()
+{
+  if (!soundsIncoming_.exchange(false, std::memory_order_acquire))
+  {
+    return;
+  }
+  for (int channel = 0; channel < 16; ++channel)
+  {
+    IncomingSound *incoming = incomingSounds_[channel].exchange(nullptr, std::memory_order_acq_rel);
+    if (incoming == nullptr)
+    {
+      continue;
+    }
+    // The old sound is still in retiredSounds_, so this never frees it.
+    forgetChannelVoices(channel);
+    regionVoices_[channel].swap(incoming->regionVoices);
+    groupVoices_[channel].swap(incoming->groupVoices);
+    channelSounds_[channel] = incoming->sound;
+    incoming->sound->decReferenceCount();
+    incoming->installed.store(true, std::memory_order_release);
+  }
+}
+
+void Synth::forgetChannelVoices(int channel)
+{
+  // The region and group indices of the old sound's voices mean nothing to
+  // the new sound, so stop counting those voices towards its polyphony.  They
+  // still end with their notes.
+  for (size_t i = 0; i < regionVoices_[channel].size(); ++i)
+  {
+    VoiceList &list = regionVoices_[channel][i];
+    while (list.getFirst())
+    {
+      VoiceList::remove(list.getFirst(), VoiceList::byRegion);
+    }
+  }
+  for (size_t i = 0; i < groupVoices_[channel].size(); ++i)
+  {
+    VoiceList &list = groupVoices_[channel][i];
+    while (list.getFirst())
+    {
+      VoiceList::remove(list.getFirst(), VoiceList::byGroup);
+    }
+  }
+}
+
+void Synth::sizeChannelVoiceLists(int channel)
+{
+  Sound *sound = getChannelSound(channel + 1);
+  size_t numRegions = sound ? static_cast<size_t>(sound->getNumRegions()) : 0;
+  size_t numGroups = sound ? static_cast<size_t>(sound->getNumGroups()) : 0;
+  if ((regionVoices_[channel].size() < numRegions) || (groupVoices_[channel].size() < numGroups))
+  {
+    forgetChannelVoices(channel);
+    regionVoices_[channel].resize(std::max(regionVoices_[channel].size(), numRegions));
+    groupVoices_[channel].resize(std::max(groupVoices_[channel].size(), numGroups));
+  }
+}
+
+water::SynthesiserSound *Synth::addSound(const water::SynthesiserSound::Ptr &sound)
+{
+  Sound *oldDefault = dynamic_cast<Sound *>(getSound(0));
+  Sound *added = dynamic_cast<Sound *>(sound.get());
+  if (added && (getSampleRate() > 0) && !added->isFrozen() && !isUsingSound(added))
+  {
+    added->prepareForSampleRate(getSampleRate());
+  }
+  water::SynthesiserSound *result = Synthesiser::addSound(sound);
+  soundsChanged(oldDefault);
+  return result;
+}
+
+void Synth::removeSound(int index)
+{
+  Sound *oldDefault = dynamic_cast<Sound *>(getSound(0));
+  Synthesiser::removeSound(index);
+  soundsChanged(oldDefault);
+}
+
+void Synth::clearSounds()
+{
+  Sound *oldDefault = dynamic_cast<Sound *>(getSound(0));
+  Synthesiser::clearSounds();
+  soundsChanged(oldDefault);
+}
+
+void Synth::soundsChanged(Sound *oldDefault)
+{
+  // Only compared, since removing it may have freed it.
+  bool defaultChanged = (dynamic_cast<Sound *>(getSound(0)) != oldDefault);
+  for (int channel = 0; channel < 16; ++channel)
+  {
+    if (defaultChanged && (channelSounds_[channel].get() == nullptr))
+    {
+      forgetChannelVoices(channel);
+    }
+    sizeChannelVoiceLists(channel);
+  }
+}
+
+Sound *Synth::getChannelSound(int midiChannel)
+{
+  Sound *sound = channelSounds_[channelIndex(midiChannel)].get();
+  return sound ? sound : dynamic_cast<Sound *>(getSound(0));
+}
+
+void Synth::setCurrentPlaybackSampleRate(double sampleRate)
+{
+  // Nothing may be playing the regions while they're prepared again.
+  if (sampleRate != getSampleRate())
+  {
+    allNotesOff(0, false);
+  }
+  Synthesiser::setCurrentPlaybackSampleRate(sampleRate);
+  for (int i = 0; i < numPoolVoices_; ++i)
+  {
+    poolVoices_[i]->setCurrentPlaybackSampleRate(sampleRate);
+  }
+  // Also covers voices given to Synthesiser::addVoice().
+  prepareVoiceTables();
+
+  for (int i = sounds.size(); --i >= 0;)
+  {
+    Sound *sound = dynamic_cast<Sound *>(sounds.getUnchecked(i));
+    if (sound && !sound->isFrozen())
+    {
+      sound->prepareForSampleRate(sampleRate);
+    }
+  }
+  for (int channel = 0; channel < 16; ++channel)
+  {
+    Sound *sound = publishedSounds_[channel].get();
+    if (sound && !sound->isFrozen() && !sounds.contains(sound))
+    {
+      sound->prepareForSampleRate(sampleRate);
+    }
+    // Also covers channels playing a sound given to Synthesiser::addSound().
+    sizeChannelVoiceLists(channel);
+  }
+}
+
+void Synth::setInterpolationQuality(InterpolationQuality quality)
+{
+  if (quality == interpolateSinc8 || quality == interpolateSinc16)
+  {
+    SincTable::get(8);
+  }
+  quality_ = quality;
+}
+
+void Synth::setRenderThreads(int numThreads, int maxBlockSize) { renderPool_.start(numThreads, maxBlockSize); }
+
+void Synth::setVoicePool(int minVoices, int maxVoices)
+{
+  voicePool_.stop();
+  minPoolVoices_ = std::max(0, minVoices);
+  maxPoolVoices_ = std::max(minPoolVoices_, maxVoices);
+  underusedFrames_ = 0;
+
+  while (numPoolVoices_ > maxPoolVoices_)
+  {
+    numPoolVoices_ -= 1;
+    delete poolVoices_[numPoolVoices_];
+  }
+  // A slot for the most voices there can be.
+  poolVoices_.resize(maxPoolVoices_, nullptr);
+
+  while (numPoolVoices_ < minPoolVoices_)
+  {
+    Voice *voice = new Voice();
+    voice->setCurrentPlaybackSampleRate(getSampleRate());
+    poolVoices_[numPoolVoices_] = voice;
+    numPoolVoices_ += 1;
+  }
+  poolSize_.store(numPoolVoices_, std::memory_order_relaxed);
+  prepareVoiceTables();
+  if (maxPoolVoices_ > 0)
+  {
+    voicePool_.start();
+  }
+}
+
+water::SynthesiserVoice *Synth::addVoice(water::SynthesiserVoice *voice)
+{
+  water::SynthesiserVoice *added = Synthesiser::addVoice(voice);
+  prepareVoiceTables();
+  return added;
+}
+
+void Synth::removeVoice(int index)
+{
+  Synthesiser::removeVoice(index);
+  prepareVoiceTables();
+}
+
+void Synth::clearVoices()
+{
+  Synthesiser::clearVoices();
+  prepareVoiceTables();
+}
+
+void Synth::prepareVoiceTables()
+{
+  // Room for the most voices there can be, so the audio thread never grows
+  // anything when managed voices arrive.
+  int maxTableSize = voices.size() + maxPoolVoices_;
+  voiceTable_.reserve(maxTableSize);
+  voiceTableSources_.reserve(maxTableSize);
+  batch_.reserve(maxTableSize);
+  batchVoices_.reserve(maxTableSize);
+  freeVoices_.reserve(maxTableSize);
+  updateVoiceTable();
+  // A new voice can land at a deleted one's address, which the table can't
+  // tell apart, so rebuild the free list regardless.
+  collectFreeVoices();
+}
+
+void Synth::resetPeakVoiceUsage() { peakVoiceUsage_.store(0, std::memory_order_relaxed); }
+
+void Synth::updateVoicePool(int numSamples)
+{
+  int numActive = numActiveVoices_.load(std::memory_order_relaxed);
+  if (numActive > peakVoiceUsage_.load(std::memory_order_relaxed))
+  {
+    peakVoiceUsage_.store(numActive, std::memory_order_relaxed);
+  }
+  if (!voicePool_.isRunning())
+  {
+    return;
+  }
+
+  // Put the voices made since the last block in the free slots.
+  while (numPoolVoices_ < maxPoolVoices_)
+  {
+    Voice *voice = voicePool_.take();
+    if (voice == nullptr)
+    {
+      break;
+    }
+    voice->setCurrentPlaybackSampleRate(getSampleRate());
+    poolVoices_[numPoolVoices_] = voice;
+    numPoolVoices_ += 1;
+  }
+
+  // Ask for more once over three quarters of all the voices are in use.
+  int numVoices = voices.size() + numPoolVoices_;
+  if ((numActive * 4 > numVoices * 3) && (numPoolVoices_ < maxPoolVoices_))
+  {
+    voicePool_.request(std::min(std::max(numPoolVoices_ / 2, 4), maxPoolVoices_ - numPoolVoices_));
+  }
+
+  // Give idle voices back once under a quarter have been in use for a while.
+  // The last taken slot fills the one given up.
+  if ((numActive * 4 < numVoices) && (numPoolVoices_ > minPoolVoices_))
+  {
+    underusedFrames_ += numSamples;
+  }
+  else
+  {
+    underusedFrames_ = 0;
+  }
+  if (underusedFrames_ > poolShrinkDelaySeconds * getSampleRate())
+  {
+    int target = std::max(minPoolVoices_, numActive * 2);
+    for (int i = numPoolVoices_; (--i >= 0) && (numPoolVoices_ > target);)
+    {
+      Voice *voice = poolVoices_[i];
+      if (voice->isVoiceActive())
+      {
+        continue;
+      }
+      VoiceList::removeFromAll(voice);
+      if (!voicePool_.giveBack(voice))
+      {
+        break;
+      }
+      numPoolVoices_ -= 1;
+      poolVoices_[i] = poolVoices_[numPoolVoices_];
+      poolVoices_[numPoolVoices_] = nullptr;
+    }
+    underusedFrames_ = 0;
+  }
+
+  poolSize_.store(numPoolVoices_, std::memory_order_relaxed);
+  // The free voices mustn't hold on to any given back.
+  updateVoiceTable();
+}
+
+void Synth::setCullLevel(float decibels)
+{
+  cullLevelDB_ = decibels;
+  cullLevel_ = decibelsToGain(decibels);
+}
 
-  int midiVelocity = static_cast<int>(velocity * 127);
+void Synth::resetVoiceCounters()
+{
+  numCulled_.store(0, std::memory_order_relaxed);
+  numStolen_.store(0, std::memory_order_relaxed);
+}
 
-  // First, stop any currently-playing sounds in the group.
-  //*** Currently, this only pays attention to the first matching region.
-  int group = 0;
-  Sound *sound = dynamic_cast<Sound *>(getSound(0));
+void Synth::collectFreeVoices()
+{
+  // Backwards, so the voices are handed out in order.
+  freeVoices_.clear();
+  numSounding_ = 0;
+  for (int i = static_cast<int>(voiceTable_.size()); --i >= 0;)
+  {
+    Voice *voice = voiceTable_[i];
+    if (voice == nullptr)
+    {
+      continue;
+    }
+    voice->setFree(!voice->isVoiceActive());
+    if (voice->isFree())
+    {
+      freeVoices_.push_back(voice);
+    }
+    else if (!voice->isStolen())
+    {
+      numSounding_ += 1;
+    }
+  }
+}
 
-  if (sound)
+Voice *Synth::findQuietestVoice()
+{
+  Voice *quietest = nullptr;
+  float quietestLevel = 0.0f;
+  int numVoices = static_cast<int>(voiceTable_.size());
+  for (int i = 0; i < numVoices; ++i)
   {
-    Region *region = sound->getRegionFor(midiNoteNumber, midiVelocity);
-    if (region)
+    Voice *voice = voiceTable_[i];
+    if ((voice == nullptr) || !voice->isVoiceActive())
+    {
+      continue;
+    }
+    // A voice that's already fading out is only cut off as a last resort.
+    float level = voice->getAudibility();
+    if (voice->isStolen())
+    {
+      level += 1.0e6f;
+    }
+    if ((quietest == nullptr) || (level < quietestLevel))
     {
-      group = region->group;
+      quietest = voice;
+      quietestLevel = level;
     }
   }
-  if (group != 0)
+  return quietest;
+}
+
+Voice *Synth::takeVoice(bool steal)
+{
+  if (!freeVoices_.empty())
   {
-    for (i = voices.size(); --i >= 0;)
+    Voice *voice = freeVoices_.back();
+    freeVoices_.pop_back();
+    voice->setFree(false);
+    // It starts from the current event.
+    catchUp(voice);
+
+    if (steal)
     {
-      Voice *voice = dynamic_cast<Voice *>(voices.getUnchecked(i));
-      if (voice == nullptr)
+      int numVoices = static_cast<int>(voiceTable_.size());
+      int reserve = std::min<int>(maxStealReserve, numVoices / 4);
+      if (numSounding_ >= numVoices - reserve)
       {
-        continue;
+        Voice *quietest = findQuietestVoice();
+        if ((quietest != nullptr) && !quietest->isStolen())
+        {
+          fadeOut(quietest);
+          numStolen_.fetch_add(1, std::memory_order_relaxed);
+        }
       }
-      if (voice->getGroup() == group)
+    }
+    numSounding_ += 1;
+    return voice;
+  }
+
+  if (!steal)
+  {
+    return nullptr;
+  }
+  Voice *quietest = findQuietestVoice();
+  if (quietest)
+  {
+    if (!quietest->isStolen())
+    {
+      numStolen_.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+      numSounding_ += 1;
+    }
+    catchUp(quietest);
+    quietest->stopNote(0.0f, false);
+    VoiceList::removeFromAll(quietest);
+  }
+  return quietest;
+}
+
+void Synth::limitPolyphony(const Region *region, int midiChannel, int midiNoteNumber)
+{
+  int channel = channelIndex(midiChannel);
+
+  if (region->polyphony > 0)
+  {
+    std::vector<VoiceList> &regionVoices = regionVoices_[channel];
+    if (region->index < static_cast<int>(regionVoices.size()))
+    {
+      VoiceList &list = regionVoices[region->index];
+      while (list.size() >= region->polyphony)
       {
-        voice->stopNoteForGroup();
+        fadeOut(list.getFirst());
       }
     }
+    else
+    {
+      limitByScan(region, midiChannel, false, region->polyphony);
+    }
   }
 
-  // Are any notes playing?  (Needed for first/legato trigger handling.)
-  // Also stop any voices still playing this note.
-  bool anyNotesPlaying = false;
-  for (i = voices.size(); --i >= 0;)
+  if (region->group_polyphony > 0)
   {
-    Voice *voice = dynamic_cast<Voice *>(voices.getUnchecked(i));
-    if (voice == nullptr)
+    std::vector<VoiceList> &groupVoices = groupVoices_[channel];
+    if (region->group_index < static_cast<int>(groupVoices.size()))
     {
-      continue;
+      VoiceList &list = groupVoices[region->group_index];
+      while (list.size() >= region->group_polyphony)
+      {
+        fadeOut(list.getFirst());
+      }
     }
-    if (voice->isPlayingChannel(midiChannel))
+    else
     {
-      if (voice->isPlayingNoteDown())
+      limitByScan(region, midiChannel, true, region->group_polyphony);
+    }
+  }
+
+  if (region->note_polyphony > 0)
+  {
+    // Only voices in the same group count.  There are seldom more than a few
+    // voices on one note.
+    VoiceList &list = noteVoices_[channel][midiNoteNumber];
+    int numInGroup = 0;
+    for (Voice *voice = list.getFirst(); voice; voice = VoiceList::getNext(voice, VoiceList::byNote))
+    {
+      if (voice->getGroup() == region->group)
       {
-        if (voice->getCurrentlyPlayingNote() == midiNoteNumber)
-        {
-          if (!voice->isPlayingOneShot())
-          {
-            voice->stopNoteQuick();
-          }
-        }
-        else
-        {
-          anyNotesPlaying = true;
-        }
+        numInGroup += 1;
+      }
+    }
+    Voice *voice = list.getFirst();
+    while (voice && (numInGroup >= region->note_polyphony))
+    {
+      Voice *next = VoiceList::getNext(voice, VoiceList::byNote);
+      if (voice->getGroup() == region->group)
+      {
+        fadeOut(voice);
+        numInGroup -= 1;
       }
+      voice = next;
     }
   }
+}
 
-  // Play *all* matching regions.
-  Region::Trigger trigger = (anyNotesPlaying ? Region::legato : Region::first);
-  if (sound)
+bool Synth::belongsWith(Voice *voice, const Region *region, int midiChannel, bool wholeGroup)
+{
+  const Region *voiceRegion = voice->getRegion();
+  if (!voice->isVoiceActive() || voice->isStolen() || (voiceRegion == nullptr) ||
+      !voice->isPlayingChannel(midiChannel))
   {
-    int numRegions = sound->getNumRegions();
-    for (i = 0; i < numRegions; ++i)
+    return false;
+  }
+  if (!wholeGroup)
+  {
+    return voiceRegion == region;
+  }
+  // Group numbers only mean something within the channel's sound, which
+  // "region" is from.
+  const std::vector<Region *> &regions = static_cast<const Sound *>(getChannelSound(midiChannel))->getRegions();
+  return (voiceRegion->group == region->group) && (voiceRegion->index < static_cast<int>(regions.size())) &&
+         (regions[voiceRegion->index] == voiceRegion);
+}
+
+void Synth::limitByScan(const Region *region, int midiChannel, bool wholeGroup, int limit)
+{
+  int numVoices = static_cast<int>(voiceTable_.size());
+  for (;;)
+  {
+    int count = 0;
+    Voice *oldest = nullptr;
+    for (int i = 0; i < numVoices; ++i)
     {
-      Region *region = sound->regionAt(i);
-      if (region->matches(midiNoteNumber, midiVelocity, trigger))
+      Voice *voice = voiceTable_[i];
+      if (voice && belongsWith(voice, region, midiChannel, wholeGroup))
       {
-        Voice *voice =
-            dynamic_cast<Voice *>(findFreeVoice(sound, midiNoteNumber, midiChannel, isNoteStealingEnabled()));
-        if (voice)
+        count += 1;
+        if ((oldest == nullptr) || voice->wasStartedBefore(*oldest))
         {
-          voice->setRegion(region);
-          startVoice(voice, sound, midiChannel, midiNoteNumber, velocity);
+          oldest = voice;
         }
       }
     }
+    if (count < limit)
+    {
+      return;
+    }
+    fadeOut(oldest);
+  }
+}
+
+void Synth::addToVoiceLists(Voice *voice, int midiChannel, int midiNoteNumber)
+{
+  VoiceList::removeFromAll(voice);
+  const Region *region = voice->getRegion();
+  if (!voice->isVoiceActive() || (region == nullptr))
+  {
+    // It didn't start after all.
+    retireIfStopped(voice);
+    return;
+  }
+  numActiveVoices_.fetch_add(1, std::memory_order_relaxed);
+
+  // The lists are only short for a sound given to Synthesiser::addSound(),
+  // whose voices limitPolyphony() finds by going through them all instead.
+  int channel = channelIndex(midiChannel);
+  std::vector<VoiceList> &regionVoices = regionVoices_[channel];
+  std::vector<VoiceList> &groupVoices = groupVoices_[channel];
+  if (region->index < static_cast<int>(regionVoices.size()))
+  {
+    regionVoices[region->index].append(voice, VoiceList::byRegion);
+  }
+  if (region->group_index < static_cast<int>(groupVoices.size()))
+  {
+    groupVoices[region->group_index].append(voice, VoiceList::byGroup);
   }
+  noteVoices_[channel][midiNoteNumber].append(voice, VoiceList::byNote);
+}
 
-  noteVelocities_[midiNoteNumber] = midiVelocity;
+void Synth::fadeOut(Voice *voice)
+{
+  if (catchUp(voice))
+  {
+    voice->steal();
+    numSounding_ -= 1;
+  }
+  VoiceList::removeFromAll(voice);
 }
 
-void Synth::noteOff(int midiChannel, int midiNoteNumber, float velocity, bool allowTailOff)
+void Synth::retireIfStopped(Voice *voice)
 {
-  Synthesiser::noteOff(midiChannel, midiNoteNumber, velocity, allowTailOff);
+  if (voice->isVoiceActive() || voice->isFree())
+  {
+    return;
+  }
+  VoiceList::removeFromAll(voice);
+  if (voice->wasCulled())
+  {
+    numCulled_.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (!voice->isStolen())
+  {
+    numSounding_ -= 1;
+  }
+  voice->setFree(true);
+  freeVoices_.push_back(voice);
+}
 
-  // Start release region.
-  Sound *sound = dynamic_cast<Sound *>(getSound(0));
-  if (sound)
+void Synth::renderNextBlock(water::AudioSampleBuffer &outputAudio, const MidiEvent *events, int numEvents,
+                            int startSample, int numSamples)
+{
+  ScopedFlushDenormals flushDenormals;
+  installIncomingSounds();
+  updateVoicePool(numSamples);
+  if ((numEvents == 0) && isTailFinished())
+  {
+    return;
+  }
+  updateVoiceTable();
+
+  renderingEvents_ = true;
+  eventLeft_ = outputAudio.getWritePointer(0, startSample);
+  eventRight_ = outputAudio.getNumChannels() > 1 ? outputAudio.getWritePointer(1, startSample) : nullptr;
+
+  // Merge the queued events in, the block's own first at the same frame.
+  int numQueued = drainMidiQueue();
+  const MidiEvent *queued = queuedEvents_.data();
+  int i = 0, j = 0;
+  while ((i < numEvents) || (j < numQueued))
   {
-    Region *region = sound->getRegionFor(midiNoteNumber, noteVelocities_[midiNoteNumber], Region::release);
-    if (region)
+    if ((j >= numQueued) || ((i < numEvents) && (events[i].time <= queued[j].time)))
     {
-      Voice *voice = dynamic_cast<Voice *>(findFreeVoice(sound, midiNoteNumber, midiChannel, false));
-      if (voice)
+      eventTime_ = std::max(0, std::min(events[i].time, numSamples));
+      i += handleEvents(events + i, numEvents - i);
+    }
+    else
+    {
+      eventTime_ = std::max(0, std::min(queued[j].time, numSamples));
+      j += handleEvents(queued + j, numQueued - j);
+    }
+  }
+
+  // Finish the voices that events have touched, then render the rest in one
+  // batch.  A voice still at position zero hasn't been rendered at all.
+  eventTime_ = numSamples;
+  int numVoices = static_cast<int>(voiceTable_.size());
+  for (int i = 0; i < numVoices; ++i)
+  {
+    Voice *voice = voiceTable_[i];
+    if (voice && (voice->getBlockPosition() > 0))
+    {
+      catchUp(voice);
+    }
+  }
+  renderingEvents_ = false;
+  renderVoices(outputAudio, startSample, numSamples);
+
+  for (int i = 0; i < numVoices; ++i)
+  {
+    if (voiceTable_[i])
+    {
+      voiceTable_[i]->setBlockPosition(0);
+    }
+  }
+}
+
+void Synth::renderNextBlock(water::AudioSampleBuffer &outputAudio, const water::MidiBuffer &inputMidi, int startSample,
+                            int numSamples)
+{
+  ScopedFlushDenormals flushDenormals;
+  installIncomingSounds();
+  updateVoicePool(numSamples);
+
+  // Without an event list to merge into, queued events all happen at the
+  // start of the block.
+  int numQueued = drainMidiQueue();
+  for (int i = 0; i < numQueued;)
+  {
+    i += handleEvents(queuedEvents_.data() + i, numQueued - i);
+  }
+  if (inputMidi.isEmpty() && (numActiveVoices_.load(std::memory_order_relaxed) == 0))
+  {
+    return;
+  }
+  Synthesiser::renderNextBlock(outputAudio, inputMidi, startSample, numSamples);
+}
+
+bool Synth::isTailFinished() const
+{
+  return (numActiveVoices_.load(std::memory_order_relaxed) == 0) && midiQueue_.isEmpty();
+}
+
+bool Synth::postMidiEvent(const MidiEvent &event) { return midiQueue_.push(event); }
+
+void Synth::setMidiQueueSize(int numEvents)
+{
+  midiQueue_.setCapacity(numEvents);
+  queuedEvents_.reserve(midiQueue_.getCapacity());
+}
+
+int Synth::drainMidiQueue()
+{
+  // Only as many as were reserved, so this never allocates; the rest wait for
+  // the next block.
+  queuedEvents_.clear();
+  MidiEvent event;
+  while ((queuedEvents_.size() < queuedEvents_.capacity()) && midiQueue_.pop(event))
+  {
+    // Producers race each other, so sort by time, keeping each one's order.
+    size_t position = queuedEvents_.size();
+    queuedEvents_.push_back(event);
+    for (; (position > 0) && (queuedEvents_[position - 1].time > event.time); --position)
+    {
+      queuedEvents_[position] = queuedEvents_[position - 1];
+    }
+    queuedEvents_[position] = event;
+  }
+  return static_cast<int>(queuedEvents_.size());
+}
+
+int Synth::handleEvents(const MidiEvent *events, int numEvents)
+{
+  if (!isNoteOnEvent(events[0]))
+  {
+    handleEvent(events[0]);
+    return 1;
+  }
+
+  // Start a chord's notes together.
+  int count = 1;
+  while ((count < numEvents) && (events[count].time == events[0].time) && isNoteOnEvent(events[count]))
+  {
+    count += 1;
+  }
+  noteOns(events, count);
+  return count;
+}
+
+bool Synth::catchUp(Voice *voice)
+{
+  int position = voice->getBlockPosition();
+  if (!renderingEvents_ || (eventTime_ <= position))
+  {
+    return voice->isVoiceActive();
+  }
+  if (voice->isVoiceActive())
+  {
+    voice->renderNextBlock(eventLeft_ + position, eventRight_ ? eventRight_ + position : nullptr,
+                           eventTime_ - position);
+    retireIfStopped(voice);
+  }
+  voice->setBlockPosition(eventTime_);
+  return voice->isVoiceActive();
+}
+
+void Synth::catchUpAll()
+{
+  int numVoices = static_cast<int>(voiceTable_.size());
+  for (int i = 0; i < numVoices; ++i)
+  {
+    if (voiceTable_[i])
+    {
+      catchUp(voiceTable_[i]);
+    }
+  }
+}
+
+void Synth::handleEvent(const MidiEvent &event)
+{
+  int midiChannel = (event.status & 0x0F) + 1;
+  // Events can come from anywhere, so keep the data bytes in range.
+  int data1 = event.data1 & 0x7F;
+  int data2 = event.data2 & 0x7F;
+
+  switch (event.status & 0xF0)
+  {
+  case 0x90:
+    if (isNoteOnEvent(event))
+    {
+      noteOn(midiChannel, data1, data2 / 127.0f);
+      break;
+    }
+    noteOff(midiChannel, data1, 0.0f, true);
+    break;
+
+  case 0x80:
+    noteOff(midiChannel, data1, data2 / 127.0f, true);
+    break;
+
+  case 0xB0:
+    // Voices only see the other controllers through their CC modulation,
+    // which they pick up a block at a time, and the sustain pedal catches up
+    // the voices it releases.  The other pedals and the channel mode messages
+    // go through all the voices.
+    if ((data1 == 0x42) || (data1 == 0x43) || (data1 >= 120))
+    {
+      catchUpAll();
+    }
+    if ((data1 == 120) || (data1 == 123))
+    {
+      allNotesOff(midiChannel, true);
+    }
+    else
+    {
+      handleController(midiChannel, data1, data2);
+    }
+    break;
+
+  case 0xE0:
+    catchUpAll();
+    handlePitchWheel(midiChannel, data1 | (data2 << 7));
+    break;
+
+  case 0xA0:
+    handleAftertouch(midiChannel, data1, data2);
+    break;
+
+  case 0xD0:
+    handleChannelPressure(midiChannel, data1);
+    break;
+
+  case 0xC0:
+    handleProgramChange(midiChannel, data1);
+    break;
+
+  default:
+    break;
+  }
+}
+
+void Synth::updateVoiceTable()
+{
+  int numOwnVoices = voices.size();
+  int numVoices = numOwnVoices + numPoolVoices_;
+
+  // prepareVoiceTables() made room for every voice, so this only moves the
+  // ends of the tables.  Voices given to Synthesiser::addVoice() since then
+  // are left out until it's called again.
+  int capacity = static_cast<int>(std::min({voiceTable_.capacity(), batch_.capacity(), batchVoices_.capacity()}));
+  jassert(numVoices <= capacity);
+  numVoices = std::min(numVoices, capacity);
+  numOwnVoices = std::min(numOwnVoices, numVoices);
+
+  bool changed = false;
+  if (static_cast<int>(voiceTable_.size()) != numVoices)
+  {
+    voiceTable_.assign(numVoices, nullptr);
+    voiceTableSources_.assign(numVoices, nullptr);
+    batch_.resize(numVoices);
+    batchVoices_.resize(numVoices);
+    changed = true;
+  }
+
+  for (int i = 0; i < numVoices; ++i)
+  {
+    water::SynthesiserVoice *voice =
+        (i < numOwnVoices) ? voices.getUnchecked(i) : poolVoices_[i - numOwnVoices];
+    if (voiceTableSources_[i] != voice)
+    {
+      voiceTableSources_[i] = voice;
+      voiceTable_[i] = dynamic_cast<Voice *>(voice);
+      changed = true;
+    }
+  }
+  if (changed)
+  {
+    collectFreeVoices();
+  }
+}
+
+void Synth::renderVoices(water::AudioSampleBuffer &outputAudio, int startSample, int numSamples)
+{
+  updateVoiceTable();
+
+  // Gather the active voices.  Voices that aren't ours, and ones already
+  // rendered, count as active too while they're still playing.
+  int numVoices = static_cast<int>(voiceTable_.size());
+  int batchSize = 0;
+  int numActive = 0;
+  for (int i = 0; i < numVoices; ++i)
+  {
+    Voice *voice = voiceTable_[i];
+    if (voice == nullptr)
+    {
+      // Not one of ours; let it render itself.
+      water::SynthesiserVoice *other = voiceTableSources_[i];
+      other->renderNextBlock(outputAudio, startSample, numSamples);
+      if (other->isVoiceActive())
       {
-        // Synthesiser is too locked-down (ivars are private rt protected), so
-        // we have to use a "setRegion()" mechanism.
-        voice->setRegion(region);
-        startVoice(voice, sound, midiChannel, midiNoteNumber, noteVelocities_[midiNoteNumber] / 127.0f);
+        numActive += 1;
+      }
+      continue;
+    }
+    if (voice->getBlockPosition() > 0)
+    {
+      // Already rendered, event by event.
+      if (voice->isVoiceActive())
+      {
+        numActive += 1;
       }
+      continue;
+    }
+    const SampleBuffer *key = voice->getSampleBuffer();
+    if (key)
+    {
+      batch_[batchSize].key = key;
+      batch_[batchSize].voice = voice;
+      batchSize += 1;
+    }
+    else
+    {
+      // Stopped since the last block without going through us, or idle.
+      retireIfStopped(voice);
+    }
+  }
+
+  if (batchSize == 0)
+  {
+    numActiveVoices_.store(numActive, std::memory_order_relaxed);
+    return;
+  }
+
+  // Voices reading the same sample data run back to back, while it's still
+  // in cache.
+  std::sort(batch_.begin(), batch_.begin() + batchSize);
+  for (int i = 0; i < batchSize; ++i)
+  {
+    batchVoices_[i] = batch_[i].voice;
+  }
+
+  float *outL = outputAudio.getWritePointer(0, startSample);
+  float *outR = outputAudio.getNumChannels() > 1 ? outputAudio.getWritePointer(1, startSample) : nullptr;
+  if (batchSize >= minParallelVoices && numSamples <= renderPool_.getMaxFrames())
+  {
+    renderPool_.render(batchVoices_.data(), batchSize, outL, outR, numSamples);
+  }
+  else
+  {
+    for (int i = 0; i < batchSize; ++i)
+    {
+      batchVoices_[i]->renderNextBlock(outL, outR, numSamples);
+    }
+  }
+
+  // Take the voices that have finished off the voice lists.
+  for (int i = 0; i < batchSize; ++i)
+  {
+    Voice *voice = batch_[i].voice;
+    retireIfStopped(voice);
+    if (voice->isVoiceActive())
+    {
+      numActive += 1;
     }
   }
+  numActiveVoices_.store(numActive, std::memory_order_relaxed);
 }
 
 int Synth::numVoicesUsed()
@@ -141,6 +1458,13 @@ int Synth::numVoicesUsed()
       numUsed += 1;
     }
   }
+  for (int i = numPoolVoices_; --i >= 0;)
+  {
+    if (poolVoices_[i]->getCurrentlyPlayingNote() >= 0)
+    {
+      numUsed += 1;
+    }
+  }
 
   return numUsed;
 }
@@ -155,9 +1479,11 @@ std::string Synth::voiceInfoString()
   std::ostringstream info;
   int numUsed = 0, numShown = 0;
 
-  for (int i = voices.size(); --i >= 0;)
+  int numOwnVoices = voices.size();
+  for (int i = numOwnVoices + numPoolVoices_; --i >= 0;)
   {
-    Voice *voice = dynamic_cast<Voice *>(voices.getUnchecked(i));
+    Voice *voice =
+        (i < numOwnVoices) ? dynamic_cast<Voice *>(voices.getUnchecked(i)) : poolVoices_[i - numOwnVoices];
     if (voice->getCurrentlyPlayingNote() < 0)
     {
       continue;
@@ -9,26 +9,367 @@
 #define SFZSYNTH_H_INCLUDED
 
 #include "SFZCommon.h"
+#include "SFZInterpolation.h"
+#include "SFZMidiQueue.h"
+#include "SFZRenderPool.h"
+#include "SFZSound.h"
+#include "SFZVoice.h"
+#include "SFZVoicePool.h"
 
 #include "water/synthesisers/Synthesiser.h"
 
+#include <atomic>
+#include <bitset>
+#include <vector>
+
 namespace sfzero
 {
 
+struct Region;
+struct SampleBuffer;
+
 class Synth : public water::Synthesiser
 {
 public:
   Synth();
-  virtual ~Synth() {}
+  virtual ~Synth();
 
   void noteOn(int midiChannel, int midiNoteNumber, float velocity) override;
   void noteOff(int midiChannel, int midiNoteNumber, float velocity, bool allowTailOff) override;
 
+  // Starts the note-ons among "events" as if noteOn() were called for each in
+  // turn, but finds free voices for all of them in one pass over the voices.
+  // For chords and other bursts of notes at one time; the events' times are
+  // ignored.  bench/Tutti.cpp compares the two.
+  void noteOns(const MidiEvent *events, int numEvents);
+
+  // Seeds the random numbers that pick between lorand/hirand layers, so a
+  // performance can be rendered the same way again.
+  void setRandomSeed(uint32_t seed);
+
+  // Keeps each channel's controller values, for locc/hicc region selection
+  // and CC modulation, and holds note-offs while the sustain pedal is down.
+  // Reset All Controllers (121) sets the channel's controllers back to their
+  // defaults, apart from volume and pan.
+  void handleController(int midiChannel, int controllerNumber, int controllerValue) override;
+  // Also drops the note-offs the sustain pedal is holding.
+  void allNotesOff(int midiChannel, bool allowTailOff) override;
+  // These also reach the managed voices.
+  void handlePitchWheel(int midiChannel, int wheelValue) override;
+  void handleAftertouch(int midiChannel, int midiNoteNumber, int aftertouchValue) override;
+  void handleChannelPressure(int midiChannel, int channelPressureValue) override;
+  void handleSostenutoPedal(int midiChannel, bool isDown) override;
+
+  // Plays "sound" on "midiChannel" (1 to 16), sharing the voices with the
+  // other channels.  Channels without a sound of their own, or set back to
+  // null, play the synth's first sound.  Choke groups and polyphony limits
+  // only count voices on the same channel.  Don't call this while the synth
+  // is rendering.
+  void setChannelSound(int midiChannel, Sound *sound);
+  // The sound the audio thread is playing on the channel.
+  Sound *getChannelSound(int midiChannel);
+
+  // Replaces the channel's sound while the synth is playing.  Call this off
+  // the audio thread, with a sound that has its samples loaded; it's
+  // prepared for the playback rate here, unless the synth may already be
+  // playing it (preparing rewrites its regions), in which case its voices work
+  // out the rate-dependent values per note.  The audio thread switches to it at
+  // the start of its next block, without locking, and notes already sounding
+  // play on with the old sound.  Old sounds are freed by later calls to this
+  // or releaseRetiredSounds(), once their last notes have ended, so the audio
+  // thread never frees one.
+  void swapChannelSound(int midiChannel, Sound *sound);
+  void releaseRetiredSounds();
+
+  // These hide Synthesiser's, to also size the channels' region and group
+  // lists for the sounds, so their choke groups and polyphony limits hold
+  // from the first note.  Sounds added through Synthesiser are still looked
+  // after, but more slowly.  Don't call these while the synth is rendering.
+  water::SynthesiserSound *addSound(const water::SynthesiserSound::Ptr &sound);
+  void removeSound(int index);
+  void clearSounds();
+
+  // Also prepares the sounds for the new rate, apart from frozen ones,
+  // stopping every voice first if the rate changes, and sizes the channels'
+  // polyphony lists for them and the per-voice tables for the voices.
+  void setCurrentPlaybackSampleRate(double sampleRate) override;
+
+  // These hide Synthesiser's, to also make room for the voices in the
+  // tables the audio thread keeps, so it never allocates for them.  Voices
+  // added through Synthesiser only play once the playback rate is set.
+  // Don't call these while the synth is rendering.
+  water::SynthesiserVoice *addVoice(water::SynthesiserVoice *voice);
+  void removeVoice(int index);
+  void clearVoices();
+
+  // Resampling quality for notes started from now on.  Call this off the
+  // audio thread: the first switch to a sinc mode builds its tables.
+  void setInterpolationQuality(InterpolationQuality quality);
+  InterpolationQuality getInterpolationQuality() const { return quality_; }
+
+  // Renders voices on "numThreads" worker threads as well as the audio
+  // thread, for blocks of up to "maxBlockSize" frames.  Zero threads (the
+  // default) renders everything on the audio thread.  Don't call this while
+  // the synth is rendering.
+  void setRenderThreads(int numThreads, int maxBlockSize);
+  int getRenderThreads() const { return renderPool_.getNumThreads(); }
+
+  // Has the synth manage voices of its own, besides any given to addVoice():
+  // it makes "minVoices" now, and when over three quarters of all the voices
+  // are in use a background thread makes more, up to "maxVoices".  Voices
+  // that sit idle for a while go back to that thread to be freed, down to
+  // "minVoices" again.  They live in a table sized for "maxVoices" here, not
+  // in "voices", so the audio thread never allocates or frees anything for
+  // them.  Zero "maxVoices" frees them all.  Don't call this while the synth
+  // is rendering.
+  void setVoicePool(int minVoices, int maxVoices);
+  // The number of managed voices, as of the last block.
+  int getVoicePoolSize() const { return poolSize_.load(std::memory_order_relaxed); }
+  // The most voices playing at the end of a block since the last reset.
+  int getPeakVoiceUsage() const { return peakVoiceUsage_.load(std::memory_order_relaxed); }
+  void resetPeakVoiceUsage();
+
+  // Releasing voices whose level falls below this stop early.  Applies to
+  // notes started from now on.
+  void setCullLevel(float decibels);
+  float getCullLevel() const { return cullLevelDB_; }
+
+  // Voices stopped for being inaudible, and voices taken for other notes,
+  // since the last reset.
+  int getNumCulledVoices() const { return numCulled_.load(std::memory_order_relaxed); }
+  int getNumStolenVoices() const { return numStolen_.load(std::memory_order_relaxed); }
+  void resetVoiceCounters();
+
+  // Renders "numSamples" frames, handling "events" (sorted by time) at their
+  // exact frames.  Unlike Synthesiser::renderNextBlock(), this doesn't split
+  // the whole block at every event: each voice renders straight through
+  // until an event changes it, so controller streams cost the voices
+  // nothing.
+  void renderNextBlock(water::AudioSampleBuffer &outputAudio, const MidiEvent *events, int numEvents, int startSample,
+                       int numSamples);
+  // Synthesiser::renderNextBlock(), after handling the queued events.
+  void renderNextBlock(water::AudioSampleBuffer &outputAudio, const water::MidiBuffer &inputMidi, int startSample,
+                       int numSamples);
+
+  // Queues an event from any thread, without locking, for the next block
+  // rendered.  Its time is a frame in that block.  Returns false if the
+  // queue is full.
+  bool postMidiEvent(const MidiEvent &event);
+  // Not for the audio thread, and drops any queued events.
+  void setMidiQueueSize(int numEvents);
+
+  // Whether the synth has nothing left to play: no voices sounding, counting
+  // releases as over once they fall below the cull level, and no queued
+  // events.  Until it gets more MIDI, rendering adds nothing to the output,
+  // and returns straight away; a host can skip calling it.  Up to date after
+  // each block.  Call it from the audio thread.
+  bool isTailFinished() const;
+
   int numVoicesUsed();
   std::string voiceInfoString();
 
+protected:
+  // Renders the active voices as one batch, ordered by the sample data they
+  // read.
+  void renderVoices(water::AudioSampleBuffer &outputAudio, int startSample, int numSamples) override;
+
 private:
-  int noteVelocities_[128];
+  // Keeps voiceTable_ in step with "voices" and the managed voices.  Only
+  // does the casts when the voice array has changed, and never allocates.
+  void updateVoiceTable();
+  // Makes room in the per-voice tables for "voices" and the most managed
+  // voices there can be, then brings them up to date.  Not for the audio
+  // thread.
+  void prepareVoiceTables();
+
+  void playNote(int midiChannel, int midiNoteNumber, float velocity);
+  // The next number from 0 to 1 for lorand/hirand.
+  float nextRandom();
+
+  // Gathers the idle voices for takeVoice() to hand out, from scratch.  Only
+  // needed when the voices change, or after something has stopped them
+  // behind our back; otherwise retireIfStopped() keeps the list up to date.
+  void collectFreeVoices();
+  // A free voice for a new note, or null.  With "steal" set, this keeps a few
+  // voices free by fading out the least audible one whenever the rest are in
+  // use, and cuts the least audible one off if there's still nothing free.
+  Voice *takeVoice(bool steal);
+  Voice *findQuietestVoice();
+
+  // Fades out the oldest voices that would put the region over its
+  // polyphony, group polyphony or note polyphony.
+  void limitPolyphony(const Region *region, int midiChannel, int midiNoteNumber);
+  // Whether the voice is one that the channel's list for "region", or with
+  // "wholeGroup" the list for its group, would hold.  For a sound the lists
+  // are too short for, which can only be one given to
+  // Synthesiser::addSound(), the voices are checked one by one instead.
+  bool belongsWith(Voice *voice, const Region *region, int midiChannel, bool wholeGroup);
+  // Fades out the oldest of those voices until fewer than "limit" are left.
+  void limitByScan(const Region *region, int midiChannel, bool wholeGroup, int limit);
+  // Adds a voice that has just started to the voice lists.
+  void addToVoiceLists(Voice *voice, int midiChannel, int midiNoteNumber);
+  // Fades the voice out quickly and takes it off the voice lists.
+  void fadeOut(Voice *voice);
+  // Takes a voice that has stopped off the voice lists and adds it to the
+  // free voices, once per note.
+  void retireIfStopped(Voice *voice);
+
+  // While rendering event by event: renders the voice up to the current
+  // event, before the event changes it.  Returns whether the voice is still
+  // playing, since it can finish on the way.
+  bool catchUp(Voice *voice);
+  void catchUpAll();
+  void handleEvent(const MidiEvent &event);
+
+  // Sets the channel's controllers to their defaults: volume 100, pan
+  // centred, expression full and the rest zero.  With "keepVolumeAndPan",
+  // those two stay as they are.
+  void resetControllers(int channel, bool keepVolumeAndPan);
+  // Sends the note-offs the sustain pedal held back.
+  void releaseSustainedNotes(int channel);
+
+  // Picks up the sounds from swapChannelSound().  Audio thread only.
+  void installIncomingSounds();
+  // Takes the channel's voices off the region and group lists, for a new
+  // sound.
+  void forgetChannelVoices(int channel);
+  // Makes the channel's region and group lists big enough for the sound it
+  // plays.  Not for the audio thread.
+  void sizeChannelVoiceLists(int channel);
+  // After the sounds have changed: forgets the voices of channels playing
+  // the first sound if that's now another one, and sizes every channel's
+  // lists.
+  void soundsChanged(Sound *oldDefault);
+  // Whether the audio thread may be playing the sound.  Off the audio thread.
+  bool isUsingSound(Sound *sound);
+  // Takes in the voice pool's new voices, asks it for more, or gives it idle
+  // ones back.  Audio thread only.
+  void updateVoicePool(int numSamples);
+  // Handles the first event, or the run of note-ons it starts.  Returns the
+  // number of events handled.
+  int handleEvents(const MidiEvent *events, int numEvents);
+  // Moves the queued events into queuedEvents_, sorted by time.
+  int drainMidiQueue();
+
+  int noteVelocities_[16][128];
+  // The number of notes played on each key, for round robins, and the round
+  // robin count and random number each key's last note started with, for its
+  // release region.
+  unsigned int keySequences_[16][128];
+  unsigned int noteSequences_[16][128];
+  float noteRandoms_[16][128];
+  uint32_t randomState_;
+  // The regions a note starts.
+  enum
+  {
+    maxRegionsPerNote = 256,
+  };
+  const Region *noteRegions_[maxRegionsPerNote];
+  InterpolationQuality quality_;
+  float cullLevelDB_, cullLevel_;
+  std::atomic<int> numCulled_, numStolen_;
+  // The voices still playing at the end of the last block, plus any started
+  // since.
+  std::atomic<int> numActiveVoices_;
+
+  VoicePool voicePool_;
+  int minPoolVoices_, maxPoolVoices_;
+  // The managed voices, in slots for "maxPoolVoices_" of them; the first
+  // numPoolVoices_ are taken.  The audio thread only moves pointers about in
+  // it.
+  std::vector<Voice *> poolVoices_;
+  int numPoolVoices_;
+  std::atomic<int> poolSize_, peakVoiceUsage_;
+  // How long under a quarter of the voices have been in use.
+  int64_t underusedFrames_;
+
+  // Voices kept free for notes starting while stolen ones fade out.
+  enum
+  {
+    maxStealReserve = 4,
+  };
+
+  // Typed copies of "voices", then the managed voices, and the voice each
+  // entry was cast from.
+  std::vector<Voice *> voiceTable_;
+  std::vector<water::SynthesiserVoice *> voiceTableSources_;
+
+  // The idle voices left to hand out, last one first, and the number of
+  // voices sounding that haven't been stolen.
+  std::vector<Voice *> freeVoices_;
+  int numSounding_;
+
+  // The batch being rendered: each active voice, keyed by the sample data it
+  // reads, and then just the voices, in that order.
+  struct BatchEntry
+  {
+    const SampleBuffer *key;
+    Voice *voice;
+
+    bool operator<(const BatchEntry &other) const { return key < other.key; }
+  };
+  std::vector<BatchEntry> batch_;
+  std::vector<Voice *> batchVoices_;
+
+  // Blocks with fewer voices than this aren't worth handing out.
+  enum
+  {
+    minParallelVoices = 8,
+  };
+  RenderPool renderPool_;
+
+  // The sound each channel plays.  Only touched on the audio thread once
+  // playing.
+  Sound::Ptr channelSounds_[16];
+  // A sound from swapChannelSound() on its way to the audio thread, with a
+  // reference for it to take over and region and group lists sized for it.
+  // The audio thread swaps the lists for the channel's old ones and sets
+  // "installed", and the old ones are freed with this off the audio thread.
+  struct IncomingSound
+  {
+    Sound *sound;
+    std::vector<VoiceList> regionVoices, groupVoices;
+    std::atomic<bool> installed;
+
+    IncomingSound() : sound(nullptr), installed(false) {}
+  };
+  std::atomic<IncomingSound *> incomingSounds_[16];
+  std::atomic<bool> soundsIncoming_;
+  // Off the audio thread: the sound last given for each channel, and the
+  // sounds replaced since, kept until nothing else holds them.  Also every
+  // IncomingSound handed over, until the audio thread is done with it.
+  Sound::Ptr publishedSounds_[16];
+  std::vector<Sound::Ptr> retiredSounds_;
+  std::vector<std::unique_ptr<IncomingSound>> incomingStore_;
+
+  // The voices still sounding, not counting ones fading out to make room, by
+  // channel and then by region, group or note.  Only touched on the audio
+  // thread once playing, which only indexes them: the region and group lists
+  // are sized for the channel's sound whenever it's set.  Voices point at
+  // their lists, so they're only resized once empty.
+  std::vector<VoiceList> regionVoices_[16], groupVoices_[16];
+  VoiceList noteVoices_[16][128];
+  // The keys held down on each channel, and the last keyswitch pressed on
+  // it, or -1.
+  std::bitset<128> notesDown_[16];
+  int lastKeyswitch_[16];
+
+  // Each channel's controller values.  Voices read their channel's row for
+  // CC modulation.
+  uint8_t controllerValues_[16][128];
+  // The notes released while the sustain pedal was down, waiting for it to
+  // come up.
+  bool sustainDown_[16];
+  std::bitset<128> sustainedNotes_[16];
+
+  MidiQueue midiQueue_;
+  std::vector<MidiEvent> queuedEvents_;
+
+  // The block being rendered event by event, and the current event's frame.
+  bool renderingEvents_;
+  float *eventLeft_, *eventRight_;
+  int eventTime_;
+
   CARLA_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Synth)
 };
 }
@@ -6,27 +6,228 @@
  *************************************************************************************/
 
 #include "SFZDebug.h"
+#include "SFZInterpolation.h"
 #include "SFZRegion.h"
 #include "SFZSample.h"
 #include "SFZSound.h"
 #include "SFZVoice.h"
 
+#include <algorithm>
 #include <sstream>
 #include <cmath>
 
 namespace sfzero
 {
 
-static const float globalGain = -1.0;
+// Number of frames, starting at "position" and stepping by "ratio", that stay
+// strictly below "limit".  Positions are computed as position + i * ratio, the
+// same way the render kernels do, so the count is exact.
+static int framesBefore(double position, double limit, double ratio)
+{
+  if (position >= limit)
+  {
+    return 0;
+  }
+  double frames = std::ceil((limit - position) / ratio);
+  if (frames > 0x7FFFFFFF)
+  {
+    return 0x7FFFFFFF;
+  }
+  int n = static_cast<int>(frames);
+  while ((n > 0) && (position + (n - 1) * ratio >= limit))
+  {
+    n -= 1;
+  }
+  while (position + n * ratio < limit)
+  {
+    n += 1;
+  }
+  return n;
+}
+
+// The time constant the CC modulation gains glide toward their new values
+// with, so controller moves don't click.
+static const double controllerSmoothingTime = 0.01;
+
+// Renders a span with no loop or end checks.  The caller guarantees that
+// every frame's interpolation taps are in the buffer and inside the loop.
+template <class Interpolator, bool exponentialEG>
+static void renderSpan(const Interpolator &interpolate, const float *inL, const float *inR, double position,
+                       double ratio, float *outL, float *outR, int numSamples, float gainLeft, float gainRight,
+                       float &ampegGain, float ampegSlope)
+{
+  float egGain = ampegGain;
+  for (int i = 0; i < numSamples; ++i)
+  {
+    double framePosition = position + i * ratio;
+    int pos = static_cast<int>(framePosition);
+    float alpha = static_cast<float>(framePosition - pos);
+    float l, r;
+    interpolate(inL, inR, pos, alpha, l, r);
+    l *= gainLeft * egGain;
+    r *= gainRight * egGain;
+    if (outR)
+    {
+      outL[i] += l;
+      outR[i] += r;
+    }
+    else
+    {
+      outL[i] += (l + r) * 0.5f;
+    }
+    egGain = exponentialEG ? egGain * ampegSlope : egGain + ampegSlope;
+  }
+  ampegGain = egGain;
+}
+
+template <class Interpolator>
+static void renderSpan(const Interpolator &interpolate, bool exponentialEG, const float *inL, const float *inR,
+                       double position, double ratio, float *outL, float *outR, int numSamples, float gainLeft,
+                       float gainRight, float &ampegGain, float ampegSlope)
+{
+  if (exponentialEG)
+  {
+    renderSpan<Interpolator, true>(interpolate, inL, inR, position, ratio, outL, outR, numSamples, gainLeft, gainRight,
+                                   ampegGain, ampegSlope);
+  }
+  else
+  {
+    renderSpan<Interpolator, false>(interpolate, inL, inR, position, ratio, outL, outR, numSamples, gainLeft,
+                                    gainRight, ampegGain, ampegSlope);
+  }
+}
+
+static void renderInterpolated(InterpolationQuality quality, bool exponentialEG, const float *inL, const float *inR,
+                               double position, double ratio, float *outL, float *outR, int numSamples,
+                               float gainLeft, float gainRight, float &ampegGain, float ampegSlope)
+{
+  switch (quality)
+  {
+  case interpolateHermite:
+    renderSpan(HermiteInterpolator(), exponentialEG, inL, inR, position, ratio, outL, outR, numSamples, gainLeft,
+               gainRight, ampegGain, ampegSlope);
+    break;
+
+  case interpolateSinc8:
+    renderSpan(SincInterpolator<8>(SincTable::get(8)), exponentialEG, inL, inR, position, ratio, outL, outR,
+               numSamples, gainLeft, gainRight, ampegGain, ampegSlope);
+    break;
+
+  case interpolateSinc16:
+    renderSpan(SincInterpolator<16>(SincTable::get(16)), exponentialEG, inL, inR, position, ratio, outL, outR,
+               numSamples, gainLeft, gainRight, ampegGain, ampegSlope);
+    break;
+
+  case interpolateLinear:
+  default:
+    renderSpan(LinearInterpolator(), exponentialEG, inL, inR, position, ratio, outL, outR, numSamples, gainLeft,
+               gainRight, ampegGain, ampegSlope);
+    break;
+  }
+}
+
+// Like renderSpan(), for a whole-frame step and position, where the
+// interpolation reduces to a gain-scaled copy.
+template <bool exponentialEG>
+static void renderStep(const float *inL, const float *inR, int position, int step, float *outL, float *outR,
+                       int numSamples, float gainLeft, float gainRight, float &ampegGain, float ampegSlope)
+{
+  float egGain = ampegGain;
+  inL += position;
+  inR += position;
+  if (outR)
+  {
+    for (int i = 0; i < numSamples; ++i)
+    {
+      outL[i] += inL[i * step] * gainLeft * egGain;
+      outR[i] += inR[i * step] * gainRight * egGain;
+      egGain = exponentialEG ? egGain * ampegSlope : egGain + ampegSlope;
+    }
+  }
+  else
+  {
+    for (int i = 0; i < numSamples; ++i)
+    {
+      outL[i] += (inL[i * step] * gainLeft + inR[i * step] * gainRight) * egGain * 0.5f;
+      egGain = exponentialEG ? egGain * ampegSlope : egGain + ampegSlope;
+    }
+  }
+  ampegGain = egGain;
+}
+
+void VoiceList::append(Voice *voice, Kind kind)
+{
+  voice->lists_[kind] = this;
+  voice->prevInList_[kind] = last_;
+  voice->nextInList_[kind] = nullptr;
+  if (last_)
+  {
+    last_->nextInList_[kind] = voice;
+  }
+  else
+  {
+    first_ = voice;
+  }
+  last_ = voice;
+  size_ += 1;
+}
+
+void VoiceList::remove(Voice *voice, Kind kind)
+{
+  VoiceList *list = voice->lists_[kind];
+  if (list == nullptr)
+  {
+    return;
+  }
+  Voice *prev = voice->prevInList_[kind];
+  Voice *next = voice->nextInList_[kind];
+  if (prev)
+  {
+    prev->nextInList_[kind] = next;
+  }
+  else
+  {
+    list->first_ = next;
+  }
+  if (next)
+  {
+    next->prevInList_[kind] = prev;
+  }
+  else
+  {
+    list->last_ = prev;
+  }
+  list->size_ -= 1;
+  voice->lists_[kind] = nullptr;
+  voice->prevInList_[kind] = voice->nextInList_[kind] = nullptr;
+}
+
+void VoiceList::removeFromAll(Voice *voice)
+{
+  for (int kind = 0; kind < numKinds; ++kind)
+  {
+    remove(voice, static_cast<Kind>(kind));
+  }
+}
+
+Voice *VoiceList::getNext(const Voice *voice, Kind kind) { return voice->nextInList_[kind]; }
 
 Voice::Voice()
-    : region_(nullptr), trigger_(0), curMidiNote_(0), curPitchWheel_(0), pitchRatio_(0), noteGainLeft_(0), noteGainRight_(0),
-      sourceSamplePosition_(0), sampleEnd_(0), loopStart_(0), loopEnd_(0), numLoops_(0), curVelocity_(0)
+    : region_(nullptr), trigger_(0), curMidiNote_(0), curPitchWheel_(0), curVelocity_(0), pitchRatio_(0), pitchStep_(0), noteGainLeft_(0), noteGainRight_(0),
+      noteGain_(0), controllerGainDecay_(0), controllers_(nullptr), sourceSamplePosition_(0), sampleBuffer_(nullptr), sampleEnd_(0),
+      loopStart_(0), loopEnd_(0), loopBuffer_(nullptr), releaseLoopAt_(0), numLoops_(0), quality_(interpolateLinear), cullLevel_(0),
+      stolen_(false), culled_(false), blockPosition_(0), free_(false)
 {
   ampeg_.setExponentialDecay(true);
+  setCurrentPlaybackSampleRate(getSampleRate());
+  for (int kind = 0; kind < VoiceList::numKinds; ++kind)
+  {
+    lists_[kind] = nullptr;
+    prevInList_[kind] = nextInList_[kind] = nullptr;
+  }
 }
 
-Voice::~Voice() {}
+Voice::~Voice() { VoiceList::removeFromAll(this); }
 
 bool Voice::canPlaySound(water::SynthesiserSound *sound) { return dynamic_cast<Sound *>(sound) != nullptr; }
 
@@ -35,6 +236,7 @@ void Voice::startNote(int midiNoteNumber, float floatVelocity, water::Synthesise
 {
   Sound *sound = dynamic_cast<Sound *>(soundIn);
 
+  stolen_ = culled_ = false;
   if (sound == nullptr)
   {
     killNote();
@@ -45,7 +247,7 @@ void Voice::startNote(int midiNoteNumber, float floatVelocity, water::Synthesise
   curVelocity_ = velocity;
   if (region_ == nullptr)
   {
-    region_ = sound->getRegionFor(midiNoteNumber, velocity);
+    region_ = static_cast<const Sound *>(sound)->getRegionFor(midiNoteNumber, velocity);
   }
   if ((region_ == nullptr) || (region_->sample == nullptr) || (region_->sample->getBuffer() == nullptr))
   {
@@ -61,58 +263,104 @@ void Voice::startNote(int midiNoteNumber, float floatVelocity, water::Synthesise
   // Pitch.
   curMidiNote_ = midiNoteNumber;
   curPitchWheel_ = currentPitchWheelPosition;
+  sampleBuffer_ = region_->sample->getBuffer();
   calcPitchRatio();
 
-  // Gain.
-  double noteGainDB = globalGain + region_->volume;
-  // Thanks to <http:://www.drealm.info/sfz/plj-sfz.xhtml> for explaining the
-  // velocity curve in a way that I could understand, although they mean
-  // "log10" when they say "log".
-  double velocityGainDB = -20.0 * log10((127.0 * 127.0) / (velocity * velocity));
-  velocityGainDB *= region_->amp_veltrack / 100.0;
-  noteGainDB += velocityGainDB;
-  noteGainLeft_ = noteGainRight_ = decibelsToGain(noteGainDB);
-  // The SFZ spec is silent about the pan curve, but a 3dB pan law seems
-  // common.  This sqrt() curve matches what Dimension LE does; Alchemy Free
-  // seems closer to sin(adjustedPan * pi/2).
-  double adjustedPan = (region_->pan + 100.0) / 200.0;
-  noteGainLeft_ *= static_cast<float>(sqrt(1.0 - adjustedPan));
-  noteGainRight_ *= static_cast<float>(sqrt(adjustedPan));
-  ampeg_.startNote(&region_->ampeg, floatVelocity, getSampleRate(), &region_->ampeg_veltrack);
+  int64_t regionLoopStart, regionLoopEnd;
+  bool regionLoops = region_->getLoopPoints(regionLoopStart, regionLoopEnd);
+  uint64_t loopCrossfadeFrames = regionLoops ? region_->getLoopCrossfadeFrames(regionLoopStart, regionLoopEnd) : 0;
 
-  // Offset/end.
-  sourceSamplePosition_ = static_cast<double>(region_->offset);
-  sampleEnd_ = region_->sample->getSampleLength();
-  if ((region_->end > 0) && (region_->end < sampleEnd_))
+  // A region that doesn't track the keyboard can play a copy of its sample
+  // that was resampled ahead of time to our rate.
+  const SampleBuffer *resampled = nullptr;
+  if ((region_->pitch_keytrack == 0) && !regionLoops)
   {
-    sampleEnd_ = region_->end + 1;
+    resampled = region_->sample->getResampled(getSampleRate());
+  }
+  if (resampled)
+  {
+    sampleBuffer_ = resampled;
+    calcPitchRatio();
   }
 
-  // Loop.
-  loopStart_ = loopEnd_ = 0;
-  Region::LoopMode loopMode = region_->loop_mode;
-  if (loopMode == Region::sample_loop)
+  // Far above the keycenter, play a band-limited, decimated copy of the
+  // sample if there is one, to keep the step near 1.  A looping region also
+  // needs its loop to stay long enough at the lower rate, and a copy of the
+  // loop filtered around it, so one with a crossfade stays on the sample.
+  int mipFactor = 1;
+  for (int factor = Sample::maxMipFactor; (factor > 1) && !resampled && (loopCrossfadeFrames == 0); factor /= 2)
   {
-    if (region_->sample->getLoopStart() < region_->sample->getLoopEnd())
+    const SampleBuffer *mipLevel = region_->sample->getMipLevel(factor);
+    if ((mipLevel == nullptr) || (pitchRatio_ < factor))
     {
-      loopMode = Region::loop_continuous;
+      continue;
     }
-    else
+    if (regionLoops && (((regionLoopEnd + 1 - regionLoopStart) / factor < maxInterpolationTaps) ||
+                        !region_->sample->getLoopBuffer(regionLoopStart, regionLoopEnd, 0, factor)))
     {
-      loopMode = Region::no_loop;
+      continue;
     }
+    sampleBuffer_ = mipLevel;
+    mipFactor = factor;
+    calcPitchRatio();
+    break;
   }
-  if ((loopMode != Region::no_loop) && (loopMode != Region::one_shot))
+
+  // Gain.  The volume and pan part, and the EG's coefficients, are usually
+  // prepared ahead of time.
+  bool prepared = region_->prepared_rate == getSampleRate();
+  if (prepared)
   {
-    if (region_->loop_start < region_->loop_end)
-    {
-      loopStart_ = region_->loop_start;
-      loopEnd_ = region_->loop_end;
-    }
-    else
+    noteGainLeft_ = region_->gain_left;
+    noteGainRight_ = region_->gain_right;
+  }
+  else
+  {
+    region_->getPanGains(noteGainLeft_, noteGainRight_);
+  }
+  int velocityIndex = std::max(0, std::min(velocity, 127));
+  float gain = region_->velocity_gains ? region_->velocity_gains[velocityIndex]
+                                               : region_->computeVelocityGain(velocityIndex);
+  if (region_->key_gains)
+  {
+    gain *= region_->key_gains[midiNoteNumber];
+  }
+  else if (region_->amp_keytrack != 0.0f)
+  {
+    gain *= region_->computeKeyGain(midiNoteNumber);
+  }
+  noteGain_ = gain;
+  if (controllers_ && (region_->num_cc_modulations > 0))
+  {
+    region_->getControllerGains(controllers_, noteGainLeft_, noteGainRight_);
+  }
+  noteGainLeft_ *= gain;
+  noteGainRight_ *= gain;
+  ampeg_.startNote(&region_->ampeg, floatVelocity, getSampleRate(), &region_->ampeg_veltrack,
+                   prepared ? &region_->ampeg_coefficients : nullptr);
+
+  // Offset/end.
+  int64_t sampleEnd = region_->sample->getSampleLength();
+  if ((region_->end > 0) && (region_->end < sampleEnd))
+  {
+    sampleEnd = region_->end + 1;
+  }
+  // Region positions are in frames of the original sample.
+  double frameScale = sampleBuffer_->sampleRate / region_->sample->getSampleRate();
+  sourceSamplePosition_ = region_->offset * frameScale;
+  sampleEnd_ = std::min(sampleEnd * frameScale, static_cast<double>(sampleBuffer_->sampleLength));
+
+  // Loop.
+  loopStart_ = loopEnd_ = 0;
+  loopBuffer_ = nullptr;
+  releaseLoopAt_ = 0;
+  if (regionLoops)
+  {
+    loopStart_ = regionLoopStart * frameScale;
+    loopEnd_ = (regionLoopEnd + 1) * frameScale;
+    if (((sampleBuffer_ == region_->sample->getBuffer()) || (mipFactor > 1)) && (sampleEnd > regionLoopEnd))
     {
-      loopStart_ = region_->sample->getLoopStart();
-      loopEnd_ = region_->sample->getLoopEnd();
+      loopBuffer_ = region_->sample->getLoopBuffer(regionLoopStart, regionLoopEnd, loopCrossfadeFrames, mipFactor);
     }
   }
   numLoops_ = 0;
@@ -132,7 +380,23 @@ void Voice::stopNote(float /*velocity*/, bool allowTailOff)
   }
   if (region_->loop_mode == Region::loop_sustain)
   {
-    // Continue playing, but stop looping.
+    // Continue playing, but stop looping.  If we were playing an unrolled
+    // loop, fold the position back into the loop first.
+    if ((loopStart_ < loopEnd_) && (sourceSamplePosition_ >= loopEnd_))
+    {
+      sourceSamplePosition_ = loopStart_ + fmod(sourceSamplePosition_ - loopStart_, loopEnd_ - loopStart_);
+    }
+    // A crossfaded loop's tail leads back into its start, not on into the
+    // sample, so from there (or near enough for the interpolation taps to
+    // reach it) play on to the end of the loop first.  The rest of the loop
+    // is the same as the sample.
+    if (loopBuffer_ && (loopBuffer_->crossfadeFrames > 0) && (loopStart_ < loopEnd_) &&
+        (sourceSamplePosition_ >= loopStart_) &&
+        (sourceSamplePosition_ + loopBuffer_->crossfadeFrames + LoopBuffer::guardFrames >= loopEnd_))
+    {
+      releaseLoopAt_ = loopEnd_;
+      return;
+    }
     loopEnd_ = loopStart_;
   }
 }
@@ -161,12 +425,23 @@ void Voice::pitchWheelMoved(int newValue)
   calcPitchRatio();
 }
 
-void Voice::controllerMoved(int /*controllerNumber*/, int /*newValue*/) { /***/}
+// The CC modulation follows the controller table from setControllers()
+// instead, once a block.
+void Voice::controllerMoved(int /*controllerNumber*/, int /*newValue*/) {}
+
+void Voice::setCurrentPlaybackSampleRate(double newRate)
+{
+  SynthesiserVoice::setCurrentPlaybackSampleRate(newRate);
+  controllerGainDecay_ = (newRate > 0) ? static_cast<float>(exp(-1.0 / (controllerSmoothingTime * newRate))) : 0.0f;
+}
+
 void Voice::renderNextBlock(water::AudioSampleBuffer &outputBuffer, int startSample, int numSamples)
 {
   float *outL = outputBuffer.getWritePointer(0, startSample);
   float *outR = outputBuffer.getNumChannels() > 1 ? outputBuffer.getWritePointer(1, startSample) : nullptr;
 
+  // For synths other than ours, which don't flush denormals themselves.
+  ScopedFlushDenormals flushDenormals;
   renderNextBlock(outL, outR, numSamples);
 }
 
@@ -177,11 +452,17 @@ void Voice::renderNextBlock(float *outL, float *outR, int numSamples)
     return;
   }
 
-  SampleBuffer *buffer = region_->sample->getBuffer();
+  if (controllers_ && (region_->num_cc_modulations > 0))
+  {
+    updateControllerGains(numSamples);
+  }
+  const SampleBuffer *buffer = sampleBuffer_;
   const float *inL = buffer->getReadPointer(0);
-  const float *inR = buffer->numChannels > 1 ? buffer->getReadPointer(1) : nullptr;
+  const float *inR = buffer->numChannels > 1 ? buffer->getReadPointer(1) : inL;
 
-  int bufferNumSamples = buffer->sampleLength; // leoo
+  int64_t bufferNumSamples = static_cast<int64_t>(buffer->sampleLength);
+  int tapsBefore, tapsAfter;
+  getInterpolationTaps(quality_, tapsBefore, tapsAfter);
 
   // Cache some values, to give them at least some chance of ending up in
   // registers.
@@ -190,66 +471,165 @@ void Voice::renderNextBlock(float *outL, float *outR, int numSamples)
   float ampegSlope = ampeg_.getSlope();
   int samplesUntilNextAmpSegment = ampeg_.getSamplesUntilNextSegment();
   bool ampSegmentIsExponential = ampeg_.getSegmentIsExponential();
-  float loopStart = static_cast<float>(this->loopStart_);
-  float loopEnd = static_cast<float>(this->loopEnd_);
-  float sampleEnd = static_cast<float>(this->sampleEnd_);
-
-  while (--numSamples >= 0)
-  {
-    int pos = static_cast<int>(sourceSamplePosition);
-    jassert(pos >= 0 && pos < bufferNumSamples); // leoo
-    float alpha = static_cast<float>(sourceSamplePosition - pos);
-    float invAlpha = 1.0f - alpha;
-    int nextPos = pos + 1;
-    if ((loopStart < loopEnd) && (nextPos > loopEnd))
+  const double pitchRatio = pitchRatio_;
+  const float peakGain = std::max(noteGainLeft_, noteGainRight_);
+
+  while (numSamples > 0)
+  {
+    // Between "fastStart" and "fastLimit", all the interpolation taps are in
+    // the buffer and on the same side of the loop seam.
+    bool looping = loopStart_ < loopEnd_;
+    bool wrapped = looping && (numLoops_ > 0);
+    double loopStart = loopStart_;
+    double loopLength = loopEnd_ - loopStart_;
+    double loopWrap = loopEnd_;
+    double fastStart = wrapped ? std::ceil(loopStart_) + tapsBefore : tapsBefore;
+    double fastLimit = std::min(sampleEnd_, static_cast<double>(bufferNumSamples - tapsAfter));
+    const float *srcL = inL;
+    const float *srcR = inR;
+    double srcOrigin = 0.0;
+
+    // Once inside a loop that has been unrolled, play from the unrolled copy.
+    // Its positions run on past loopEnd for numPeriods loop lengths, and its
+    // guard frames hold the loop's own start and end, so no frame needs the
+    // boundary checks.
+    bool unrolled =
+        looping && loopBuffer_ && (wrapped || (sourceSamplePosition >= loopStart + loopBuffer_->entryFrames));
+    if (unrolled)
     {
-      nextPos = static_cast<int>(loopStart);
+      srcL = loopBuffer_->getReadPointer(0);
+      srcR = loopBuffer_->numChannels > 1 ? loopBuffer_->getReadPointer(1) : srcL;
+      srcOrigin = loopStart;
+      loopWrap = loopStart + loopLength * loopBuffer_->numPeriods;
+      fastStart = loopStart;
+      fastLimit = loopWrap;
+      if (releaseLoopAt_ > 0.0)
+      {
+        fastLimit = std::min(fastLimit, releaseLoopAt_);
+      }
+    }
+    else if (looping)
+    {
+      fastLimit = std::min(fastLimit, std::ceil(loopEnd_) - tapsAfter);
+      // Switch to the loop's copy as soon as possible, since a crossfaded
+      // loop sounds different before its first wrap as well.
+      if (loopBuffer_ && (sourceSamplePosition < loopStart + loopBuffer_->entryFrames))
+      {
+        fastLimit = std::min(fastLimit, loopStart + loopBuffer_->entryFrames);
+      }
     }
 
-    // Simple linear interpolation with buffer overrun check
-    float nextL = nextPos < bufferNumSamples ? inL[nextPos] : inL[pos];
-    float nextR = inR ? (nextPos < bufferNumSamples ? inR[nextPos] : inR[pos]) : nextL;
-    float l = (inL[pos] * invAlpha + nextL * alpha);
-    float r = inR ? (inR[pos] * invAlpha + nextR * alpha) : l;
-
-    //// Simple linear interpolation, old version (possible buffer overrun with non-loop??)
-    // float l = (inL[pos] * invAlpha + inL[nextPos] * alpha);
-    // float r = inR ? (inR[pos] * invAlpha + inR[nextPos] * alpha) : l;
-
-    float gainLeft = noteGainLeft_ * ampegGain;
-    float gainRight = noteGainRight_ * ampegGain;
-    l *= gainLeft;
-    r *= gainRight;
-    // Shouldn't we dither here?
+    // Plan the span: up to the block end, the next EG segment change, and the
+    // loop seam or sample end, whichever comes first.
+    int spanLength = numSamples;
+    if (samplesUntilNextAmpSegment < spanLength)
+    {
+      spanLength = samplesUntilNextAmpSegment + 1;
+    }
+    if (sourceSamplePosition < fastStart)
+    {
+      spanLength = 0;
+    }
+    spanLength = std::min(spanLength, framesBefore(sourceSamplePosition, fastLimit, pitchRatio));
 
-    if (outR)
+    float gainLeft = noteGainLeft_;
+    float gainRight = noteGainRight_;
+    double srcPosition = sourceSamplePosition - srcOrigin;
+    if ((spanLength > 0) && (pitchStep_ > 0) && (srcPosition == std::floor(srcPosition)))
     {
-      *outL++ += l;
-      *outR++ += r;
+      // Whole-frame steps from a whole-frame position: nothing to interpolate.
+      int pos = static_cast<int>(srcPosition);
+      if (ampSegmentIsExponential)
+      {
+        renderStep<true>(srcL, srcR, pos, pitchStep_, outL, outR, spanLength, gainLeft, gainRight, ampegGain,
+                         ampegSlope);
+      }
+      else
+      {
+        renderStep<false>(srcL, srcR, pos, pitchStep_, outL, outR, spanLength, gainLeft, gainRight, ampegGain,
+                          ampegSlope);
+      }
+      sourceSamplePosition += static_cast<double>(spanLength) * pitchStep_;
+    }
+    else if (spanLength > 0)
+    {
+      renderInterpolated(quality_, ampSegmentIsExponential, srcL, srcR, srcPosition, pitchRatio, outL, outR, spanLength,
+                         gainLeft, gainRight, ampegGain, ampegSlope);
+      sourceSamplePosition += spanLength * pitchRatio;
     }
     else
     {
-      *outL++ += (l + r) * 0.5f;
+      // We're near the loop seam or an end of the sample: gather the taps for
+      // a single frame, wrapping them around the loop and clamping them to the
+      // buffer.
+      spanLength = 1;
+      int64_t pos = static_cast<int64_t>(sourceSamplePosition);
+      jassert(pos >= 0 && pos < bufferNumSamples); // leoo
+      float alpha = static_cast<float>(sourceSamplePosition - pos);
+      // A decimated loop can have a fractional length; its taps wrap by the
+      // nearest whole number of frames.
+      int64_t loopFrames = static_cast<int64_t>(loopLength + 0.5);
+      float tapsL[maxInterpolationTaps], tapsR[maxInterpolationTaps];
+      for (int k = -tapsBefore; k <= tapsAfter; ++k)
+      {
+        int64_t tapPos = pos + k;
+        if (looping && (loopFrames > 0))
+        {
+          while (tapPos >= loopEnd_)
+          {
+            tapPos -= loopFrames;
+          }
+          while (wrapped && (tapPos < loopStart_))
+          {
+            tapPos += loopFrames;
+          }
+        }
+        tapPos = std::max<int64_t>(0, std::min(tapPos, bufferNumSamples - 1));
+        tapsL[tapsBefore + k] = inL[tapPos];
+        tapsR[tapsBefore + k] = inR[tapPos];
+      }
+      float l, r;
+      interpolateFrame(quality_, tapsL, tapsR, tapsBefore, alpha, l, r);
+      l *= gainLeft * ampegGain;
+      r *= gainRight * ampegGain;
+      if (outR)
+      {
+        *outR += r;
+        *outL += l;
+      }
+      else
+      {
+        *outL += (l + r) * 0.5f;
+      }
+      ampegGain = ampSegmentIsExponential ? ampegGain * ampegSlope : ampegGain + ampegSlope;
+      sourceSamplePosition += pitchRatio;
     }
 
-    // Next sample.
-    sourceSamplePosition += pitchRatio_;
-    if ((loopStart < loopEnd) && (sourceSamplePosition > loopEnd))
+    outL += spanLength;
+    if (outR)
     {
-      sourceSamplePosition = loopStart;
-      numLoops_ += 1;
+      outR += spanLength;
     }
+    numSamples -= spanLength;
 
-    // Update EG.
-    if (ampSegmentIsExponential)
+    // A loop_sustain release waiting for the end of the loop stops looping
+    // there, carrying on from the same point in the sample.  Otherwise wrap
+    // around the loop, keeping the sub-sample phase.
+    if ((releaseLoopAt_ > 0.0) && (sourceSamplePosition >= releaseLoopAt_))
     {
-      ampegGain *= ampegSlope;
+      sourceSamplePosition -= loopLength;
+      loopEnd_ = loopStart_;
+      releaseLoopAt_ = 0.0;
     }
-    else
+    else if (looping && (sourceSamplePosition >= loopWrap))
     {
-      ampegGain += ampegSlope;
+      numLoops_ += static_cast<int>((sourceSamplePosition - loopStart) / loopLength);
+      sourceSamplePosition = loopStart + fmod(sourceSamplePosition - loopStart, loopLength);
     }
-    if (--samplesUntilNextAmpSegment < 0)
+
+    // Update EG.
+    samplesUntilNextAmpSegment -= spanLength;
+    if (samplesUntilNextAmpSegment < 0)
     {
       ampeg_.setLevel(ampegGain);
       ampeg_.nextSegment();
@@ -259,8 +639,17 @@ void Voice::renderNextBlock(float *outL, float *outR, int numSamples)
       ampSegmentIsExponential = ampeg_.getSegmentIsExponential();
     }
 
-    if ((sourceSamplePosition >= sampleEnd) || ampeg_.isDone())
+    if ((!unrolled && (sourceSamplePosition >= sampleEnd_)) || ampeg_.isDone())
+    {
+      killNote();
+      break;
+    }
+
+    // The release only gets quieter, so once it's below the cull level the
+    // rest of it can't be heard either.
+    if (ampeg_.isReleasing() && (ampegGain * peakGain < cullLevel_))
     {
+      culled_ = true;
       killNote();
       break;
     }
@@ -279,7 +668,23 @@ int Voice::getGroup() { return region_ ? region_->group : 0; }
 
 int64_t Voice::getOffBy() { return region_ ? region_->off_by : 0; }
 
-void Voice::setRegion(Region *nextRegion) { region_ = nextRegion; }
+void Voice::setRegion(const Region *nextRegion) { region_ = nextRegion; }
+
+void Voice::setInterpolationQuality(InterpolationQuality quality) { quality_ = quality; }
+
+void Voice::setCullLevel(float gain) { cullLevel_ = gain; }
+
+float Voice::getAudibility() const
+{
+  float peakGain = std::max(noteGainLeft_, noteGainRight_);
+  return ampeg_.isStarting() ? peakGain : peakGain * ampeg_.getLevel();
+}
+
+void Voice::steal()
+{
+  stolen_ = true;
+  ampeg_.fastRelease();
+}
 
 std::string Voice::infoString()
 {
@@ -300,6 +705,28 @@ std::string Voice::infoString()
   return info.str();
 }
 
+void Voice::updateControllerGains(int numSamples)
+{
+  // The gains step once per block, by as far as they'd glide over its frames:
+  // the decay per frame raised to the block length, by repeated squaring.
+  float remaining = 1.0f;
+  float decay = controllerGainDecay_;
+  for (int n = numSamples; n > 0; n >>= 1)
+  {
+    if (n & 1)
+    {
+      remaining *= decay;
+    }
+    decay *= decay;
+  }
+  float share = 1.0f - remaining;
+
+  float targetLeft, targetRight;
+  region_->getControllerGains(controllers_, targetLeft, targetRight);
+  noteGainLeft_ += (targetLeft * noteGain_ - noteGainLeft_) * share;
+  noteGainRight_ += (targetRight * noteGain_ - noteGainRight_) * share;
+}
+
 void Voice::calcPitchRatio()
 {
   double note = curMidiNote_;
@@ -308,6 +735,7 @@ void Voice::calcPitchRatio()
   note += region_->tune / 100.0;
 
   double adjustedPitch = region_->pitch_keycenter + (note - region_->pitch_keycenter) * (region_->pitch_keytrack / 100.0);
+  adjustedPitch += region_->pitch_veltrack * curVelocity_ / (127.0 * 100.0);
   if (curPitchWheel_ != 8192)
   {
     double wheel = ((2.0 * curPitchWheel_ / 16383.0) - 1.0);
@@ -320,9 +748,17 @@ void Voice::calcPitchRatio()
       adjustedPitch += wheel * region_->bend_down / -100.0;
     }
   }
-  double targetFreq = fractionalMidiNoteInHz(adjustedPitch);
-  double naturalFreq = fractionalMidiNoteInHz(region_->pitch_keycenter);
-  pitchRatio_ = (targetFreq * region_->sample->getSampleRate()) / (naturalFreq * getSampleRate());
+  // exp2() keeps whole-octave transpositions exact, so they can take the
+  // integer-step path below.
+  double freqRatio = std::exp2((adjustedPitch - region_->pitch_keycenter) / 12.0);
+  pitchRatio_ = (freqRatio * sampleBuffer_->sampleRate) / getSampleRate();
+
+  // Unit and other whole-number ratios can skip the interpolation.
+  pitchStep_ = 0;
+  if ((pitchRatio_ >= 1.0) && (pitchRatio_ < 64.0) && (pitchRatio_ == std::floor(pitchRatio_)))
+  {
+    pitchStep_ = static_cast<int>(pitchRatio_);
+  }
 }
 
 void Voice::killNote()
@@ -331,9 +767,4 @@ void Voice::killNote()
   clearCurrentNote();
 }
 
-double Voice::fractionalMidiNoteInHz(double note)
-{
-  return 8.17579891564 * exp(0.0577622650 * note);
-}
-
 }
@@ -9,6 +9,7 @@
 #define SFZVOICE_H_INCLUDED
 
 #include "SFZEG.h"
+#include "SFZInterpolation.h"
 
 #include "water/synthesisers/Synthesiser.h"
 
@@ -16,6 +17,38 @@ namespace sfzero
 {
 
 struct Region;
+struct LoopBuffer;
+struct SampleBuffer;
+class Voice;
+
+// A list of voices, oldest first, linked through the voices themselves so
+// that adding and removing take constant time and never allocate.  A voice
+// can be in one list of each kind at once.
+class VoiceList
+{
+public:
+  enum Kind
+  {
+    byRegion,
+    byGroup,
+    byNote,
+    numKinds
+  };
+
+  VoiceList() : first_(nullptr), last_(nullptr), size_(0) {}
+
+  void append(Voice *voice, Kind kind);
+  static void remove(Voice *voice, Kind kind);
+  static void removeFromAll(Voice *voice);
+
+  Voice *getFirst() const { return first_; }
+  static Voice *getNext(const Voice *voice, Kind kind);
+  int size() const { return size_; }
+
+private:
+  Voice *first_, *last_;
+  int size_;
+};
 
 class Voice : public water::SynthesiserVoice
 {
@@ -30,7 +63,11 @@ public:
   void stopNoteQuick();
   void pitchWheelMoved(int newValue) override;
   void controllerMoved(int controllerNumber, int newValue) override;
+  // Also works out how fast the CC modulation gains glide at the new rate.
+  void setCurrentPlaybackSampleRate(double newRate) override;
   void renderNextBlock(water::AudioSampleBuffer &outputBuffer, int startSample, int numSamples) override;
+  // Leaves flushing denormals to the caller (see ScopedFlushDenormals), which
+  // Synth and RenderPool do once per block and per thread.
   void renderNextBlock(float *outL, float *outR, int numSamples);
   bool isPlayingNoteDown();
   bool isPlayingOneShot();
@@ -39,28 +76,81 @@ public:
   int64_t getOffBy();
 
   // Set the region to be used by the next startNote().
-  void setRegion(Region *nextRegion);
+  void setRegion(const Region *nextRegion);
+
+  // The sample data being played, or nullptr if the voice is idle.
+  const SampleBuffer *getSampleBuffer() const { return region_ ? sampleBuffer_ : nullptr; }
+
+  // Synth sets these before starting each note.
+  void setInterpolationQuality(InterpolationQuality quality);
+  // A releasing voice quieter than this (as a gain) stops.
+  void setCullLevel(float gain);
+  // The controller values of the note's channel, for the region's CC
+  // modulation.  They're read at the start of each block, so the table has to
+  // outlive the note.  Null leaves the modulation out.
+  void setControllers(const uint8_t *controllers) { controllers_ = controllers; }
+
+  // How loud the voice is now: the louder side's note gain times the EG
+  // level.  A voice still in its delay or attack counts at its full level.
+  float getAudibility() const;
+  // Fades the voice out quickly to make room for another note.
+  void steal();
+  bool isStolen() const { return stolen_; }
+  // Whether the last note ended by falling below the cull level.
+  bool wasCulled() const { return culled_; }
+
+  const Region *getRegion() const { return region_; }
+
+  // How far into the current block the voice has been rendered, while Synth
+  // is rendering a block event by event.  Zero otherwise.
+  int getBlockPosition() const { return blockPosition_; }
+  void setBlockPosition(int position) { blockPosition_ = position; }
+  // Whether the voice is in Synth's list of free voices.
+  bool isFree() const { return free_; }
+  void setFree(bool isFree) { free_ = isFree; }
 
   std::string infoString();
 
 private:
-  Region *region_;
+  friend class VoiceList;
+
+  const Region *region_;
   int trigger_;
-  int curMidiNote_, curPitchWheel_;
+  int curMidiNote_, curPitchWheel_, curVelocity_;
   double pitchRatio_;
+  int pitchStep_;
   float noteGainLeft_, noteGainRight_;
+  // The velocity and key part of the note gains, for working them out again
+  // when the controllers move, and how much of the way to their new values
+  // the gains are left to go after a frame.
+  float noteGain_;
+  float controllerGainDecay_;
+  const uint8_t *controllers_;
   double sourceSamplePosition_;
   EG ampeg_;
-  int64_t sampleEnd_;
-  int64_t loopStart_, loopEnd_;
-
-  // Info only.
+  // The sample data being played; positions are in its frames.  It can be a
+  // decimated or resampled copy of the region's sample.
+  const SampleBuffer *sampleBuffer_;
+  double sampleEnd_;
+  // loopEnd_ is exclusive: it's where the loop wraps back to loopStart_.
+  double loopStart_, loopEnd_;
+  const LoopBuffer *loopBuffer_;
+  // After a loop_sustain release in a crossfaded loop's tail, where the voice
+  // stops looping, at the loop's end; zero otherwise.
+  double releaseLoopAt_;
   int numLoops_;
-  int curVelocity_;
+  InterpolationQuality quality_;
+  float cullLevel_;
+  bool stolen_, culled_;
+  int blockPosition_;
+  bool free_;
+  VoiceList *lists_[VoiceList::numKinds];
+  Voice *prevInList_[VoiceList::numKinds], *nextInList_[VoiceList::numKinds];
 
   void calcPitchRatio();
+  // Moves the note gains toward the ones the controllers now ask for.
+  void updateControllerGains(int numSamples);
   void killNote();
-  double fractionalMidiNoteInHz(double note);
 
   CARLA_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Voice)
 };
@@ -0,0 +1,110 @@
+/*************************************************************************************
+ * Original code copyright (C) 2012 Steve Folta
+ * Converted to Juce module (C) 2016 Leo Olivers
+ * Forked from https://github.com/stevefolta/SFZero
+ * For license info please see the LICENSE file distributed with this source code
+ *************************************************************************************/
+
+#include "SFZVoicePool.h"
+#include "SFZVoice.h"
+
+namespace sfzero
+{
+
+VoicePool::VoicePool() : requested_(0), quit_(false)
+{
+  for (int i = 0; i < numSlots; ++i)
+  {
+    made_[i].store(nullptr);
+    freed_[i].store(nullptr);
+  }
+}
+
+VoicePool::~VoicePool() { stop(); }
+
+void VoicePool::start()
+{
+  stop();
+  quit_.store(false);
+  thread_ = std::thread([this] { run(); });
+}
+
+void VoicePool::stop()
+{
+  if (thread_.joinable())
+  {
+    quit_.store(true);
+    workSignal_.signal();
+    thread_.join();
+  }
+  requested_.store(0);
+  for (int i = 0; i < numSlots; ++i)
+  {
+    delete made_[i].exchange(nullptr);
+    delete freed_[i].exchange(nullptr);
+  }
+}
+
+void VoicePool::request(int numVoices)
+{
+  int none = 0;
+  if (requested_.compare_exchange_strong(none, numVoices, std::memory_order_release, std::memory_order_relaxed))
+  {
+    workSignal_.signal();
+  }
+}
+
+Voice *VoicePool::take()
+{
+  for (int i = 0; i < numSlots; ++i)
+  {
+    if (made_[i].load(std::memory_order_relaxed) != nullptr)
+    {
+      return made_[i].exchange(nullptr, std::memory_order_acquire);
+    }
+  }
+  return nullptr;
+}
+
+bool VoicePool::giveBack(Voice *voice)
+{
+  for (int i = 0; i < numSlots; ++i)
+  {
+    if (freed_[i].load(std::memory_order_relaxed) == nullptr)
+    {
+      freed_[i].store(voice, std::memory_order_release);
+      workSignal_.signal();
+      return true;
+    }
+  }
+  return false;
+}
+
+void VoicePool::run()
+{
+  while (!quit_.load(std::memory_order_relaxed))
+  {
+    for (int i = 0; i < numSlots; ++i)
+    {
+      delete freed_[i].exchange(nullptr, std::memory_order_acquire);
+    }
+
+    int numWanted = requested_.load(std::memory_order_acquire);
+    for (int i = 0; (i < numSlots) && (numWanted > 0); ++i)
+    {
+      if (made_[i].load(std::memory_order_relaxed) == nullptr)
+      {
+        made_[i].store(new Voice(), std::memory_order_release);
+        numWanted -= 1;
+      }
+    }
+    // Whatever didn't fit is dropped; the audio thread asks again if it
+    // still needs more.
+    requested_.store(0, std::memory_order_release);
+
+    // Signals that came in while working just mean an extra look.
+    workSignal_.wait();
+  }
+}
+
+}
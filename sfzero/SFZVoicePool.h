@@ -0,0 +1,63 @@
+/*************************************************************************************
+ * Original code copyright (C) 2012 Steve Folta
+ * Converted to Juce module (C) 2016 Leo Olivers
+ * Forked from https://github.com/stevefolta/SFZero
+ * For license info please see the LICENSE file distributed with this source code
+ *************************************************************************************/
+#ifndef SFZVOICEPOOL_H_INCLUDED
+#define SFZVOICEPOOL_H_INCLUDED
+
+#include "SFZCommon.h"
+
+#include <atomic>
+#include <thread>
+
+namespace sfzero
+{
+
+class Voice;
+
+// A background thread that makes voices when the audio thread asks for them,
+// and frees the ones it hands back, so that the audio thread never allocates
+// or frees a voice.  Voices pass each way through a fixed set of slots,
+// without locks, and the thread sleeps on a semaphore until the audio thread
+// asks for or hands back one.
+class VoicePool
+{
+public:
+  // The most voices on their way in either direction at once.
+  static const int numSlots = 32;
+
+  VoicePool();
+  ~VoicePool();
+
+  // Not for the audio thread.  stop() frees any voices still in the slots.
+  void start();
+  void stop();
+  bool isRunning() const { return thread_.joinable(); }
+
+  // For the audio thread.  Asks for "numVoices" more voices, unless some
+  // are already on their way.
+  void request(int numVoices);
+  // A voice made since, or null.
+  Voice *take();
+  // Hands a voice over to be freed.  Returns false if there's no room for
+  // it now.
+  bool giveBack(Voice *voice);
+
+private:
+  void run();
+
+  std::atomic<Voice *> made_[numSlots];
+  std::atomic<Voice *> freed_[numSlots];
+  std::atomic<int> requested_;
+  std::atomic<bool> quit_;
+  // Signalled for each request and each voice handed back.
+  Semaphore workSignal_;
+  std::thread thread_;
+
+  CARLA_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(VoicePool)
+};
+}
+
+#endif // SFZVOICEPOOL_H_INCLUDED